@@ -0,0 +1,29 @@
+#!/bin/sh
+
+# Benchmark of the accesses to the variables of the enclosing functions: builds
+# a program of ${DEPTH} nested functions, the innermost one updating a variable
+# of every enclosing function in a loop of ${ITERATIONS} iterations, and prints
+# the run time at every optimization level with bench.sh.
+DEPTH=${DEPTH:-5}
+ITERATIONS=${ITERATIONS:-10000000}
+source=build/bench_display.tig
+
+mkdir -p build
+
+awk -v depth=${DEPTH} -v iterations=${ITERATIONS} 'BEGIN {
+    print "let"
+    for (level = 1; level < depth; level++) {
+        printf "function f%d(n: int): int = let var v%d := %d\n", level, level, level
+    }
+    printf "function f%d(n: int): int = (for i := 1 to n do (", depth
+    for (level = 1; level < depth; level++) {
+        printf "v%d := v%d + v%d + i; ", level, level, depth - level
+    }
+    print "()); 0)"
+    for (level = depth - 1; level >= 1; level--) {
+        printf "in f%d(n) + v%d end\n", level + 1, level
+    }
+    printf "in printd(f1(%d)) end\n", iterations
+}' > ${source}
+
+RUNS=${RUNS:-1} ./bench.sh ${source}
@@ -0,0 +1,27 @@
+#!/bin/sh
+
+# Benchmark of the calls of nested functions: builds a program whose hot
+# recursive helper reads parameters of the function that declares it, calls it
+# ${CALLS} levels deep (fib-like, about 1.6^${CALLS} calls), and prints the run
+# time at every optimization level with bench.sh.
+CALLS=${CALLS:-38}
+source=build/bench_lift.tig
+
+mkdir -p build
+
+cat > ${source} <<TIGER
+let
+  function run(n: int, m: int, step: int): int =
+    let
+      function f(k: int): int =
+        if k < 2 then k
+        else let var s := f(k - 1) + f(k - 2) + step in if s >= m then s - m else s end
+    in
+      f(n)
+    end
+in
+  printd(run(${CALLS}, 1000003, 7))
+end
+TIGER
+
+RUNS=${RUNS:-1} ./bench.sh ${source}
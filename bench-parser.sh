@@ -0,0 +1,32 @@
+#!/bin/sh
+
+# Benchmark of the parsers: compiles tests3/test_10.tig repeated ${COPIES}
+# times in a sequence and prints the time of syntactic analysis with the bison
+# parser and with the hand-written one. The shifts of the program, that Tiger
+# does not have, are replaced by divisions and multiplications.
+COPIES=${COPIES:-1000}
+RUNS=${RUNS:-5}
+source=build/bench_parser.tig
+
+mkdir -p build
+
+{
+    echo "("
+    i=1
+    while [ ${i} -lt ${COPIES} ]; do
+        sed -e 's/>>/\//g' -e 's/<</*/g' tests3/test_10.tig
+        echo ";"
+        i=$((i + 1))
+    done
+    sed -e 's/>>/\//g' -e 's/<</*/g' tests3/test_10.tig
+    echo ")"
+} > ${source}
+
+for parser in bison pratt; do
+    echo "-parser=${parser}"
+    i=0
+    while [ ${i} -lt ${RUNS} ]; do
+        build/tc -p ${source} -parser=${parser} -no-codegen -time-phases 2>&1 | grep "syntactic analysis"
+        i=$((i + 1))
+    done
+done
@@ -0,0 +1,31 @@
+#!/bin/sh
+
+# Microbenchmark of the symbol tables: compiles a program made of ${DEPTH}
+# nested "let" blocks, each one declaring variables that shadow the outer ones
+# and reading the outermost one, and prints the time of semantic analysis.
+DEPTH=${DEPTH:-2000}
+RUNS=${RUNS:-5}
+source=build/bench_symboltable.tig
+
+mkdir -p build
+
+{
+    echo "let var v0 := 0 var w := 0 in"
+    i=1
+    while [ ${i} -lt ${DEPTH} ]; do
+        echo "let var v${i} := v$((i - 1)) + v0 var w := w + v${i} in"
+        i=$((i + 1))
+    done
+    echo "w"
+    i=0
+    while [ ${i} -lt ${DEPTH} ]; do
+        echo "end"
+        i=$((i + 1))
+    done
+} > ${source}
+
+i=0
+while [ ${i} -lt ${RUNS} ]; do
+    build/tc -p ${source} -no-codegen -time-phases 2>&1 | grep "semantic analysis"
+    i=$((i + 1))
+done
@@ -0,0 +1,29 @@
+#!/bin/sh
+
+# Builds the programs given as arguments, the tests3 (SNU-RT) ones by default,
+# at every optimization level and prints the time taken by ${RUNS} runs of each
+# generated executable.
+RUNS=${RUNS:-100}
+
+if [ $# -eq 0 ]; then
+    set -- tests3/test_*.tig
+fi
+
+for level in 0 1 2 3; do
+    for test in "$@"; do
+        name=$(basename ${test} .tig)
+        output=build/bench_O${level}_${name}
+
+        build/tc -p ${test} -o ${output} -O${level} > /dev/null 2>&1 || continue
+
+        start=$(date +%s%N)
+        i=0
+        while [ ${i} -lt ${RUNS} ]; do
+            ${output} > /dev/null < /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+
+        echo "-O${level} ${name}: $(( (end - start) / 1000000 )) ms"
+    done
+done
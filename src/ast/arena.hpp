@@ -0,0 +1,76 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace AST {
+    /* The arena frees the nodes, the owning pointers of the AST only express the tree shape. */
+    struct ArenaDeleter {
+        template<typename T>
+        void operator()(T *) const {}
+    };
+
+    template<typename T>
+    using unique_ptr = std::unique_ptr<T, ArenaDeleter>;
+
+    /*
+     * Per-compilation arena owning the AST. Nodes are bump-allocated and all of
+     * them are released at once when the arena is destroyed: the destructors of
+     * the objects that need one run in a flat loop (not recursively through the
+     * tree) and the memory is freed slab by slab.
+     */
+    class Arena {
+        struct Destructor {
+            void (*destroy)(void *);
+            void *object;
+        };
+
+        llvm::BumpPtrAllocator allocator_;
+        std::vector<Destructor> destructors_;
+
+    public:
+        Arena() = default;
+
+        Arena(Arena const &) = delete;
+
+        Arena &operator=(Arena const &) = delete;
+
+        ~Arena() {
+            for (auto it = destructors_.rbegin(); it != destructors_.rend(); ++it) {
+                it->destroy(it->object);
+            }
+        }
+
+        template<typename T, typename... Args>
+        T *make(Args &&... args) {
+            auto object = new(allocator_.Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+
+            if (!std::is_trivially_destructible<T>::value) {
+                destructors_.push_back({[](void *object) { static_cast<T *>(object)->~T(); }, object});
+            }
+
+            return object;
+        }
+
+        /* Copies "text" into the arena, for the strings that are not slices of the source. */
+        llvm::StringRef copy(llvm::StringRef text) {
+            auto data = static_cast<char *>(allocator_.Allocate(text.size(), 1));
+            std::copy(text.begin(), text.end(), data);
+
+            return llvm::StringRef(data, text.size());
+        }
+
+        template<typename T, typename... Args>
+        unique_ptr<T> makeUnique(Args &&... args) {
+            return unique_ptr<T>(make<T>(std::forward<Args>(args)...));
+        }
+    };
+}  // namespace AST
+
+#endif  // ARENA_HPP
@@ -1,4 +1,5 @@
 #include "ast.hpp"
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/DerivedTypes.h>
 #include "utils/symboltable.hpp"
 #include <iostream>
@@ -17,15 +18,30 @@ static string getTabs(size_t depth) {
     return tabs.str();
 }
 
-llvm::Type *Root::traverse(vector<VarDec *> &, CodeGenContext &context) {
-    context.typeDecs.reset();
+llvm::Type *Node::traverse(vector<VarDec *> &variableTable, CodeGenContext &context) {
+    return runTasks<llvm::Type *>(this, &variableTable, [&context](Task<llvm::Type *> &task, Node *&child) {
+        return task.node->traverseStep(task, context, child);
+    });
+}
+
+llvm::Type *Root::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        context.typeDecs.reset();
+        task.variableTable = &mainVariableTable_;
+        child = root_.get();
+        return nullptr;
+    }
 
-    return root_->traverse(mainVariableTable_, context);
+    return task.results[0];
 }
 
-llvm::Type *AST::FieldVar::traverse(vector<VarDec *> &variableTable,
-                                    CodeGenContext &context) {
-    auto var = var_->traverse(variableTable, context);
+llvm::Type *AST::FieldVar::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        child = var_.get();
+        return nullptr;
+    }
+
+    auto var = task.results[0];
 
     if (!var) {
         return nullptr;
@@ -39,12 +55,12 @@ llvm::Type *AST::FieldVar::traverse(vector<VarDec *> &variableTable,
     auto *eleType = llvm::cast<llvm::StructType>(context.getElementType(var));
 
     auto typeDec =
-            dynamic_cast<RecordType *>(context.typeDecs[eleType->getStructName()]);
+            dynamic_cast<RecordType *>(context.typeDecs[Symbol(eleType->getStructName())]);
     assert(typeDec);
 
     idx_ = 0u;
     for (auto &field : typeDec->fields_) {
-        if (field->getName() == field_.getName()) {
+        if (field->getSymbol() == field_.getSymbol()) {
             break;
         } else {
             ++idx_;
@@ -61,19 +77,28 @@ llvm::Type *AST::FieldVar::traverse(vector<VarDec *> &variableTable,
     return type_;
 }
 
-llvm::Type *AST::SubscriptVar::traverse(vector<VarDec *> &variableTable,
-                                        CodeGenContext &context) {
-    auto var = var_->traverse(variableTable, context);
-    if (!var) {
+llvm::Type *AST::SubscriptVar::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        child = var_.get();
         return nullptr;
     }
-    if (!var->isPointerTy() || context.getElementType(var)->isStructTy()) {
-        return context.logErrorT("Subscript is only for array type",
-                                 var_->getLoc());
+
+    if (task.step == 1) {
+        auto var = task.results[0];
+        if (!var) {
+            return nullptr;
+        }
+        if (!var->isPointerTy() || context.getElementType(var)->isStructTy()) {
+            return context.logErrorT("Subscript is only for array type",
+                                     var_->getLoc());
+        }
+
+        type_ = context.getElementType(var);
+        child = exp_.get();
+        return nullptr;
     }
 
-    type_ = context.getElementType(var);
-    auto exp = exp_->traverse(variableTable, context);
+    auto exp = task.results[1];
     if (!exp) {
         return nullptr;
     }
@@ -85,59 +110,83 @@ llvm::Type *AST::SubscriptVar::traverse(vector<VarDec *> &variableTable,
     return type_;
 }
 
-llvm::Type *AST::VarExp::traverse(vector<VarDec *> &variableTable,
-                                  CodeGenContext &context) {
-    return var_->traverse(variableTable, context);
+llvm::Type *AST::VarExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &, Node *&child) {
+    if (task.step == 0) {
+        child = var_.get();
+        return nullptr;
+    }
+
+    return task.results[0];
 }
 
-llvm::Type *AST::NilExp::traverse(vector<VarDec *> &, CodeGenContext &context) {
+llvm::Type *AST::NilExp::traverseStep(Task<llvm::Type *> &, CodeGenContext &context, Node *&) {
     return context.nilType;
 }
 
-llvm::Type *AST::IntExp::traverse(vector<VarDec *> &, CodeGenContext &context) {
+llvm::Type *AST::IntExp::traverseStep(Task<llvm::Type *> &, CodeGenContext &context, Node *&) {
     return context.intType;
 }
 
-llvm::Type *AST::StringExp::traverse(vector<VarDec *> &,
-                                     CodeGenContext &context) {
+llvm::Type *AST::StringExp::traverseStep(Task<llvm::Type *> &, CodeGenContext &context, Node *&) {
     return context.stringType;
 }
 
-llvm::Type *CallExp::traverse(vector<VarDec *> &variableTable,
-                              CodeGenContext &context) {
-    auto function = context.functions[func_.getName()];
-    if (!function) {
-        return context.logErrorT("Function " +
-                                 func_.getName() +
-                                 " undeclared", func_.getLoc());
+llvm::Type *CallExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    auto step = task.step;
+    if (step == 0) {
+        callee_ = context.functionDecs[func_.getSymbol()];
+        function_ = callee_ ? nullptr : context.functions[func_.getSymbol()];
+        if (!callee_ && !function_) {
+            return context.logErrorT("Function " +
+                                     func_.getName() +
+                                     " undeclared", func_.getLoc());
+        }
+        if (callee_) {
+            level_ = context.currentLevel;
+            declared_ = context.declaredVariables;
+            context.calls.push_back(this);
+            if (context.currentFunction) {
+                callee_->calledBy(context.currentFunction);
+            }
+        }
     }
 
-    if (args_.size() != function->arg_size()) {
+    // the static link and the captures are passed by codegen, they are not arguments of the call
+    auto functionType = callee_ ? callee_->getProto().getType() : function_->getFunctionType();
+    if (step == 0 && args_.size() != functionType->getNumParams()) {
         return context.logErrorT("Incorrect number of passed arguments",
                                  getLoc());
     }
 
-    size_t i = 0u;
-    for (auto &exp : args_) {
-        auto type = exp->traverse(variableTable, context);
-        auto arg = function->getFunctionType()->getParamType(i++);
-        if (arg != type) {
-            return context.logErrorT("Params type not match",
-                                     exp->getLoc());
-        }
+    if (step > 0 && functionType->getParamType(step - 1) != task.results[step - 1]) {
+        return context.logErrorT("Params type not match",
+                                 args_[step - 1]->getLoc());
     }
 
-    return function->getReturnType();
+    if (step < args_.size()) {
+        child = args_[step].get();
+        return nullptr;
+    }
+
+    return functionType->getReturnType();
 }
 
-llvm::Type *BinaryExp::traverse(vector<VarDec *> &variableTable,
-                                CodeGenContext &context) {
-    auto left = left_->traverse(variableTable, context);
-    auto right = right_->traverse(variableTable, context);
+llvm::Type *BinaryExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step < 2) {
+        child = task.step == 0 ? left_.get() : right_.get();
+        return nullptr;
+    }
+
+    auto left = task.results[0];
+    auto right = task.results[1];
     if (!left || !right) {
         return nullptr;
     }
 
+    return checkOperands(left, right, context);
+}
+
+llvm::Type *BinaryExp::checkOperands(llvm::Type *left, llvm::Type *right, CodeGenContext &context) {
     switch (this->op_) {
         case ADD:
         case SUB:
@@ -170,84 +219,103 @@ llvm::Type *BinaryExp::traverse(vector<VarDec *> &variableTable,
 
 llvm::Type *Field::traverse(vector<VarDec *> &variableTable,
                             CodeGenContext &context) {
-    type_ = context.typeOf(getLoc(), typeName_.getName());
+    type_ = context.typeOf(getLoc(), typeName_.getSymbol());
+    // the parameters belong to the body of the function, one level deeper
     varDec_ = new VarDec(getLoc(),
                          name_, type_,
-                         variableTable.size(), context.currentLevel);
-    context.valueDecs.push(name_.getName(), varDec_);
+                         variableTable.size(), context.currentLevel + 1);
     variableTable.push_back(varDec_);
 
     return type_;
 }
 
-llvm::Type *FieldExp::traverse(vector<VarDec *> &variableTable,
-                               CodeGenContext &context) {
-    type_ = exp_->traverse(variableTable, context);
+llvm::Type *FieldExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &, Node *&child) {
+    if (task.step == 0) {
+        child = exp_.get();
+        return nullptr;
+    }
+
+    type_ = task.results[0];
 
     return type_;
 }
 
-llvm::Type *RecordExp::traverse(vector<VarDec *> &variableTable,
-                                CodeGenContext &context) {
-    type_ = context.typeOf(typeName_->getLoc(), typeName_->getName().getName());
-    if (!type_) {
-        return nullptr;
-    }
-    if (!type_->isPointerTy()) {
-        return context.logErrorT("Require a record type", typeName_->getLoc());
-    }
+llvm::Type *RecordExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    auto step = task.step;
+    if (step == 0) {
+        type_ = context.typeOf(typeName_->getLoc(), typeName_->getName().getSymbol());
+        if (!type_) {
+            return nullptr;
+        }
+        if (!type_->isPointerTy()) {
+            return context.logErrorT("Require a record type", typeName_->getLoc());
+        }
 
-//    auto eleType = context.getElementType(type_);
-//    if (!eleType->isStructTy()) {
-//        return context.logErrorT("Require a record type", typeName_->getLoc());
-//    }
+//        auto eleType = context.getElementType(type_);
+//        if (!eleType->isStructTy()) {
+//            return context.logErrorT("Require a record type", typeName_->getLoc());
+//        }
 
-    auto typeDec = dynamic_cast<RecordType *>(context.typeDecs[typeName_->getName().getName()]);
-    assert(typeDec);
-    if (typeDec->fields_.size() != fieldExps_.size()) {
-        return context.logErrorT("Wrong number of fields", getLoc());
+        typeDec_ = dynamic_cast<RecordType *>(context.typeDecs[typeName_->getName().getSymbol()]);
+        assert(typeDec_);
+        if (typeDec_->fields_.size() != fieldExps_.size()) {
+            return context.logErrorT("Wrong number of fields", getLoc());
+        }
+    } else {
+        auto &fieldDec = typeDec_->fields_[step - 1];
+        if (!context.isMatch(task.results[step - 1], fieldDec->getType())) {
+            return context.logErrorT("Field type not match", fieldDec->getLoc());
+        }
     }
 
-    size_t idx = 0u;
-    for (auto &fieldDec : typeDec->fields_) {
-        auto &field = fieldExps_[idx];
-        if (field->getName() != fieldDec->getName()) {
+    if (step < fieldExps_.size()) {
+        auto &field = fieldExps_[step];
+        if (field->getSymbol() != typeDec_->fields_[step]->getSymbol()) {
             return context.logErrorT(
                     field->getName() +
                     " is not a field or not on the right position of "
                     + typeName_->getName().getName(), getLoc());
         }
 
-        auto exp = field->traverse(variableTable, context);
-        if (!context.isMatch(exp, fieldDec->getType())) {
-            return context.logErrorT("Field type not match", fieldDec->getLoc());
-        }
-
-        ++idx;
+        child = field.get();
+        return nullptr;
     }
 
     return type_;
 }
 
-llvm::Type *SequenceExp::traverse(vector<VarDec *> &variableTable,
-                                  CodeGenContext &context) {
-    llvm::Type *last = context.voidType;
-
-    for (auto &exp : exps_) {
-        last = exp->traverse(variableTable, context);
+llvm::Type *SequenceExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step < exps_.size()) {
+        child = exps_[task.step].get();
+        return nullptr;
     }
 
-    return last;
+    return exps_.empty() ? context.voidType : task.results.back();
 }
 
-llvm::Type *AssignExp::traverse(vector<VarDec *> &variableTable,
-                                CodeGenContext &context) {
-    auto var = var_->traverse(variableTable, context);
+llvm::Type *AssignExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        child = var_.get();
+        return nullptr;
+    }
+
+    auto var = task.results[0];
     if (!var) {
         return nullptr;
     }
 
-    auto exp = exp_->traverse(variableTable, context);
+    if (task.step == 1) {
+        // a variable assigned by a nested function is shared through its frame
+        auto simpleVar = dynamic_cast<SimpleVar *>(var_.get());
+        if (simpleVar && simpleVar->getVarDec()->getLevel() != context.currentLevel) {
+            simpleVar->getVarDec()->escape();
+        }
+
+        child = exp_.get();
+        return nullptr;
+    }
+
+    auto exp = task.results[1];
     if (!exp) {
         return nullptr;
     }
@@ -259,54 +327,77 @@ llvm::Type *AssignExp::traverse(vector<VarDec *> &variableTable,
     }
 }
 
-llvm::Type *IfExp::traverse(vector<VarDec *> &variableTable,
-                            CodeGenContext &context) {
-    auto test = test_->traverse(variableTable, context);
+llvm::Type *IfExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        child = test_.get();
+        return nullptr;
+    }
+
+    auto test = task.results[0];
     if (!test) {
         return nullptr;
     }
 
-    auto then = then_->traverse(variableTable, context);
-    if (!then) {
+    if (task.step == 1) {
+        child = then_.get();
         return nullptr;
     }
 
-    if (!test->isIntegerTy()) {
-        return context.logErrorT("Require integer in test", test_->getLoc());
+    auto then = task.results[1];
+    if (!then) {
+        return nullptr;
     }
 
-    if (else_) {
-        auto elsee = else_->traverse(variableTable, context);
-        if (!elsee) {
-            return nullptr;
+    if (task.step == 2) {
+        if (!test->isIntegerTy()) {
+            return context.logErrorT("Require integer in test", test_->getLoc());
         }
 
-        if (!context.isMatch(then, elsee)) {
-            return context.logErrorT("Require same type in both branch", else_->getLoc());
+        if (else_) {
+            child = else_.get();
+            return nullptr;
+        } else if (!then->isVoidTy()) {
+            return context.logErrorT("\"Then\" returns a value but \"Else\" doesnt", then_->getLoc());
+        } else {
+            return context.voidType;
         }
-    } else if (!then->isVoidTy()) {
-        return context.logErrorT("\"Then\" returns a value but \"Else\" doesnt", then_->getLoc());
-    } else {
-        return context.voidType;
+    }
+
+    auto elsee = task.results[2];
+    if (!elsee) {
+        return nullptr;
+    }
+
+    if (!context.isMatch(then, elsee)) {
+        return context.logErrorT("Require same type in both branch", else_->getLoc());
     }
 
     return then;
 }
 
-llvm::Type *WhileExp::traverse(vector<VarDec *> &variableTable,
-                               CodeGenContext &context) {
-    context.inLoopStack.push(true);
+llvm::Type *WhileExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        context.inLoopStack.push(true);
 
-    auto test = test_->traverse(variableTable, context);
-    if (!test) {
+        child = test_.get();
         return nullptr;
     }
 
-    if (!test->isIntegerTy()) {
-        return context.logErrorT("Require integer", test_->getLoc());
+    if (task.step == 1) {
+        auto test = task.results[0];
+        if (!test) {
+            return nullptr;
+        }
+
+        if (!test->isIntegerTy()) {
+            return context.logErrorT("Require integer", test_->getLoc());
+        }
+
+        child = body_.get();
+        return nullptr;
     }
 
-    auto bodyType = body_->traverse(variableTable, context);
+    auto bodyType = task.results[1];
 
     if (bodyType != context.voidType) {
         return context.logErrorT("While Body do not returns value", body_->getLoc());
@@ -317,20 +408,29 @@ llvm::Type *WhileExp::traverse(vector<VarDec *> &variableTable,
     return context.voidType;
 }
 
-llvm::Type *DoWhileExp::traverse(vector<VarDec *> &variableTable,
-                                 CodeGenContext &context) {
-    context.inLoopStack.push(true);
+llvm::Type *DoWhileExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        context.inLoopStack.push(true);
 
-    auto test = test_->traverse(variableTable, context);
-    if (!test) {
+        child = test_.get();
         return nullptr;
     }
 
-    if (!test->isIntegerTy()) {
-        return context.logErrorT("Require integer", test_->getLoc());
+    if (task.step == 1) {
+        auto test = task.results[0];
+        if (!test) {
+            return nullptr;
+        }
+
+        if (!test->isIntegerTy()) {
+            return context.logErrorT("Require integer", test_->getLoc());
+        }
+
+        child = body_.get();
+        return nullptr;
     }
 
-    auto bodyType = body_->traverse(variableTable, context);
+    auto bodyType = task.results[1];
 
     if (bodyType != context.voidType) {
         return context.logErrorT("While Body do not returns value", body_->getLoc());
@@ -341,31 +441,48 @@ llvm::Type *DoWhileExp::traverse(vector<VarDec *> &variableTable,
     return context.voidType;
 }
 
-llvm::Type *ForExp::traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) {
-    context.inLoopStack.push(true);
+llvm::Type *ForExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        context.inLoopStack.push(true);
 
-    auto low = low_->traverse(variableTable, context);
-    if (!low) {
+        child = low_.get();
         return nullptr;
     }
 
-    auto high = high_->traverse(variableTable, context);
-    if (!high) {
+    auto low = task.results[0];
+    if (!low) {
         return nullptr;
     }
 
-    if (!low->isIntegerTy() || !high->isIntegerTy()) {
-        return context.logErrorT("For bounds require integer", getLoc());
+    if (task.step == 1) {
+        child = high_.get();
+        return nullptr;
     }
 
-    varDec_ = new VarDec(getLoc(),
-                         var_, context.intType,
-                         variableTable.size(), context.currentLevel);
-    variableTable.push_back(varDec_);
-    context.valueDecs.push(var_.getName(), varDec_);
+    if (task.step == 2) {
+        auto high = task.results[1];
+        if (!high) {
+            return nullptr;
+        }
 
-    auto body = body_->traverse(variableTable, context);
+        if (!low->isIntegerTy() || !high->isIntegerTy()) {
+            return context.logErrorT("For bounds require integer", getLoc());
+        }
+
+        auto &variableTable = *task.variableTable;
+        varDec_ = new VarDec(getLoc(),
+                             var_, context.intType,
+                             variableTable.size(), context.currentLevel);
+        variableTable.push_back(varDec_);
+        context.valueDecs.enter();
+        context.valueDecs.push(var_.getSymbol(), varDec_);
+
+        child = body_.get();
+        return nullptr;
+    }
+
+    auto body = task.results[2];
+    context.valueDecs.exit();
     if (!body) {
         return nullptr;
     }
@@ -375,8 +492,7 @@ llvm::Type *ForExp::traverse(vector<VarDec *> &variableTable,
     return context.voidType;
 }
 
-llvm::Type *AST::BreakExp::traverse(vector<VarDec *> &,
-                                    CodeGenContext &context) {
+llvm::Type *AST::BreakExp::traverseStep(Task<llvm::Type *> &, CodeGenContext &context, Node *&) {
     if (context.inLoopStack.empty() || !context.inLoopStack.top()) {
         return context.logErrorT("Break is only allowed on Loop statements",
                                  getLoc());
@@ -385,40 +501,51 @@ llvm::Type *AST::BreakExp::traverse(vector<VarDec *> &,
     return context.voidType;
 }
 
-llvm::Type *LetExp::traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) {
-    context.types.enter();
-    context.typeDecs.enter();
-    context.valueDecs.enter();
-    context.functions.enter();
+llvm::Type *LetExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    auto step = task.step;
+    if (step == 0) {
+        context.typeDecs.enter();
+        context.valueDecs.enter();
+        context.functionDecs.enter();
 
-    for (auto &dec : decs_) {
-        if (!dec->computeHeaderTraverse(variableTable, context)) {
-            return nullptr;
+        for (auto &dec : decs_) {
+            if (!dec->computeHeaderTraverse(*task.variableTable, context)) {
+                return nullptr;
+            }
+        }
+
+        for (auto &dec : decs_) {
+            if (dec->getKind() == Dec::Kind::Type
+                && !static_cast<TypeDec *>(dec.get())->resolve(context)) {
+                return nullptr;
+            }
         }
     }
 
-    for (auto &dec : decs_) {
-        if (!dec->traverse(variableTable, context)) {
+    // the declarations, then the body
+    if (step <= decs_.size()) {
+        if (step > 0 && !task.results.back()) {
             return nullptr;
         }
+
+        child = step < decs_.size() ? static_cast<Node *>(decs_[step].get()) : body_.get();
+        return nullptr;
     }
 
-    auto body = body_->traverse(variableTable, context);
+    auto body = task.results.back();
 
-    context.functions.exit();
+    context.functionDecs.exit();
     context.valueDecs.exit();
     context.typeDecs.exit();
-    context.types.exit();
 
     return body;
 }
 
 bool TypeDec::computeHeaderTraverse(vector<VarDec *> &vector,
                                     CodeGenContext &context) {
-    if (context.typeDecs.lookupOne(name_.getName())
-        && this->getConcreteType() == (context.lastDec ? context.lastDec->getConcreteType() : "")
-        && this->getName() == context.lastDec->getName()) {
+    if (context.typeDecs.lookupOne(name_.getSymbol())
+        && context.lastDec && getKind() == context.lastDec->getKind()
+        && this->getSymbol() == context.lastDec->getSymbol()) {
         context.logErrorT("Type "
                           + name_.getName()
                           + " is already defined in same scope.",
@@ -430,33 +557,45 @@ bool TypeDec::computeHeaderTraverse(vector<VarDec *> &vector,
     context.lastDec = this;
 
     type_->setName(name_);
-    context.typeDecs.lookupOne(name_.getName()) = type_.get();
+    context.typeDecs.push(name_.getSymbol(), type_.get());
 
     return true;
 }
 
-llvm::Type *TypeDec::traverse(vector<VarDec *> &, CodeGenContext &context) {
+bool TypeDec::resolve(CodeGenContext &context) {
+    return type_->resolve(context) && type_->define(context);
+}
+
+llvm::Type *TypeDec::traverseStep(Task<llvm::Type *> &, CodeGenContext &context, Node *&) {
     return context.voidType;
 }
 
-llvm::Type *ArrayExp::traverse(vector<VarDec *> &variableTable,
-                               CodeGenContext &context) {
-    type_ = context.typeOf(getLoc(), typeName_->getName().getName());
-    if (!type_) {
+llvm::Type *ArrayExp::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        type_ = context.typeOf(getLoc(), typeName_->getName().getSymbol());
+        if (!type_) {
+            return nullptr;
+        }
+
+        if (!type_->isPointerTy()) {
+            return context.logErrorT("Array type required", typeName_->getLoc());
+        }
+
+        child = init_.get();
         return nullptr;
     }
 
-    if (!type_->isPointerTy()) {
-        return context.logErrorT("Array type required", typeName_->getLoc());
+    auto init = task.results[0];
+    if (!init) {
+        return nullptr;
     }
 
-    auto eleType = context.getElementType(type_);
-    auto init = init_->traverse(variableTable, context);
-    if (!init) {
+    if (task.step == 1) {
+        child = size_.get();
         return nullptr;
     }
 
-    auto size = size_->traverse(variableTable, context);
+    auto size = task.results[1];
     if (!size) {
         return nullptr;
     }
@@ -464,7 +603,7 @@ llvm::Type *ArrayExp::traverse(vector<VarDec *> &variableTable,
         return context.logErrorT("Size should be integer", size_->getLoc());
     }
 
-    if (eleType != init) {
+    if (context.getElementType(type_) != init) {
         return context.logErrorT("Initial type not matches", init_->getLoc());
     }
 
@@ -473,6 +612,8 @@ llvm::Type *ArrayExp::traverse(vector<VarDec *> &variableTable,
 
 llvm::FunctionType *Prototype::traverse(vector<VarDec *> &variableTable,
                                         CodeGenContext &context) {
+    staticLink_ = llvm::PointerType::getUnqual(context.staticLink.front());
+    frame = llvm::StructType::create(context.context, getName());
     std::vector<llvm::Type *> args;
 
     for (auto &field : params_) {
@@ -484,23 +625,21 @@ llvm::FunctionType *Prototype::traverse(vector<VarDec *> &variableTable,
 
     resultType_ = result_.getName().empty()
                   ? llvm::Type::getVoidTy(context.context)
-                  : context.typeOf(getLoc(), result_.getName());
+                  : context.typeOf(getLoc(), result_.getSymbol());
     if (!resultType_) {
         return nullptr;
     }
 
-    auto functionType = llvm::FunctionType::get(resultType_, args, false);
-    function_ = llvm::Function::Create(functionType, llvm::Function::InternalLinkage,
-                                       getName(), context.module.get());
+    type_ = llvm::FunctionType::get(resultType_, args, false);
 
-    return functionType;
+    return type_;
 }
 
 bool FunctionDec::computeHeaderTraverse(vector<VarDec *> &vector,
                                         CodeGenContext &context) {
-    if (context.functions.lookupOne(name_.getName())
-        && this->getConcreteType() == (context.lastDec ? context.lastDec->getConcreteType() : "")
-        && this->getName() == context.lastDec->getName()) {
+    if (context.functionDecs.lookupOne(name_.getSymbol())
+        && context.lastDec && getKind() == context.lastDec->getKind()
+        && this->getSymbol() == context.lastDec->getSymbol()) {
         context.logErrorT("Function "
                           + name_.getName() +
                           " is already defined in same scope.", name_.getLoc());
@@ -513,19 +652,38 @@ bool FunctionDec::computeHeaderTraverse(vector<VarDec *> &vector,
         return false;
     }
 
-    context.functions.lookupOne(name_.getName()) = proto_->getFunction();
+    level_ = context.currentLevel;
+    context.functionDecs.push(name_.getSymbol(), this);
     context.lastDec = this;
 
     return true;
 }
 
-llvm::Type *FunctionDec::traverse(vector<VarDec *> &, CodeGenContext &context) {
-    auto body = body_->traverse(variableTable_, context);
-    if (!body) {
+llvm::Type *FunctionDec::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        parent_ = context.currentFunction;
+        context.currentFunction = this;
+        context.declaredFunctions.push_back(this);
+        ++context.currentLevel;
+        context.staticLink.push_front(proto_->getFrame());
+        context.valueDecs.enter();
+        for (auto &param : proto_->getParams()) {
+            context.valueDecs.push(param->getSymbol(), param->getVar());
+        }
+
+        task.variableTable = &variableTable_;
+        child = body_.get();
         return nullptr;
     }
 
+    auto body = task.results[0];
+    context.valueDecs.exit();
+    context.staticLink.pop_front();
     --context.currentLevel;
+    context.currentFunction = parent_;
+    if (!body) {
+        return nullptr;
+    }
 
     auto retType = proto_->getResultType();
 
@@ -543,13 +701,113 @@ llvm::Type *FunctionDec::traverse(vector<VarDec *> &, CodeGenContext &context) {
     return context.voidType;
 }
 
-llvm::Type *SimpleVar::traverse(vector<VarDec *> &, CodeGenContext &context) {
-    auto var = context.valueDecs[name_.getName()];
+bool FunctionDec::capture(VarDec *var) {
+    return var->getLevel() <= level_ && captures_.insert(var);
+}
+
+bool FunctionDec::reach(size_t level) {
+    if (level > level_ || level >= outerLevel_) {
+        return false;
+    }
+    outerLevel_ = level;
+
+    return true;
+}
+
+/*
+ * Lambda lifting: a variable is shared through the frame of its function only
+ * when a nested function assigns it, the functions that read the others get
+ * their values as arguments. What a function captures and the frames it
+ * reaches flow to the functions that call it and to the one that declares it,
+ * until nothing changes, and again while a call reads a capture before its
+ * declaration. A function that reaches no enclosing frame has no static link,
+ * the frame of main is a global, so no top level function has one.
+ */
+void FunctionDec::lift(vector<FunctionDec *> const &functions, vector<CallExp *> const &calls) {
+    auto undeclared = false;
+    do {
+        propagate(functions);
+
+        undeclared = false;
+        for (auto call : calls) {
+            undeclared |= call->escapeUndeclared();
+        }
+    } while (undeclared);
+
+    for (auto function : functions) {
+        if (function->outerLevel_ > function->level_) {
+            function->proto_->dropStaticLink();
+        }
+    }
+}
+
+void FunctionDec::propagate(vector<FunctionDec *> const &functions) {
+    for (auto function : functions) {
+        for (auto var : function->captures_) {
+            if (var->isEscaping() && var->getLevel() > 0) {
+                function->reach(var->getLevel());
+            }
+        }
+        function->captures_.remove_if([](VarDec *var) { return var->isEscaping(); });
+    }
+
+    vector<FunctionDec *> worklist(functions.rbegin(), functions.rend());
+    while (!worklist.empty()) {
+        auto function = worklist.back();
+        worklist.pop_back();
+
+        if (auto parent = function->parent_) {
+            auto changed = parent->reach(function->outerLevel_);
+            for (auto var : function->captures_) {
+                changed |= parent->capture(var);
+            }
+            if (changed) {
+                worklist.push_back(parent);
+            }
+        }
+
+        // the static link of the function is the frame of its level in the caller
+        for (auto caller : function->callers_) {
+            auto changed = function->outerLevel_ <= function->level_ && caller->reach(function->level_);
+            for (auto var : function->captures_) {
+                changed |= caller->capture(var);
+            }
+            if (changed) {
+                worklist.push_back(caller);
+            }
+        }
+    }
+}
+
+/*
+ * A capture declared in the function that makes the call has no value yet when
+ * the call precedes its declaration, as in "var y := f()  var x := 1" where f
+ * reads x: it is read from the frame instead, like an assigned one.
+ */
+bool CallExp::escapeUndeclared() {
+    auto escaped = false;
+    for (auto var : callee_->getCaptures()) {
+        if (var->getLevel() == level_ && var->getDeclared() > declared_) {
+            var->escape();
+            escaped = true;
+        }
+    }
+
+    return escaped;
+}
+
+llvm::Type *SimpleVar::traverseStep(Task<llvm::Type *> &, CodeGenContext &context, Node *&) {
+    auto var = context.valueDecs[name_.getSymbol()];
 
     if (!var) {
         return context.logErrorT(name_.getName()
                                  + " is not defined", name_.getLoc());
     }
+    varDec_ = var;
+
+    if (var->getLevel() != context.currentLevel) {
+        context.currentFunction->capture(var);
+    }
 
     return var->getType();
 }
@@ -561,14 +819,18 @@ bool VarDec::computeHeaderTraverse(vector<VarDec *> &vector,
     return true;
 }
 
-llvm::Type *VarDec::traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) {
-    offset_ = variableTable.size();
-    level_ = context.currentLevel;
-    variableTable.push_back(this);
-    global = true;
+llvm::Type *VarDec::traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        offset_ = task.variableTable->size();
+        level_ = context.currentLevel;
+        task.variableTable->push_back(this);
+        global = true;
+
+        child = init_.get();
+        return nullptr;
+    }
 
-    auto init = init_->traverse(variableTable, context);
+    auto init = task.results[0];
 
     if (!typeName_) {
         if (init == context.nilType) {
@@ -578,7 +840,7 @@ llvm::Type *VarDec::traverse(vector<VarDec *> &variableTable,
         type_ = init;
     } else {
         type_ = context.typeOf(typeName_->getName().getLoc(),
-                               typeName_->getName().getName());
+                               typeName_->getName().getSymbol());
 
         if (!context.isMatch(type_, init)) {
             return context.logErrorT("Type not match", typeName_->getLoc());
@@ -596,92 +858,65 @@ llvm::Type *VarDec::traverse(vector<VarDec *> &variableTable,
         return context.logErrorT("Type not match", typeName_->getLoc());
     }
 
-    context.valueDecs.lookupOne(name_.getName()) = this;
+    declared_ = ++context.declaredVariables;
+    context.valueDecs.push(name_.getSymbol(), this);
 
     return context.voidType;
 }
 
-llvm::Type *AST::ArrayType::traverse(std::set<std::string> &parentName,
-                                     CodeGenContext &context) {
-    if (context.types[name_.getName()]) {
-        return context.types[name_.getName()];
+llvm::Type *AST::Type::resolve(CodeGenContext &context) {
+    switch (state_) {
+        case State::Resolved:
+            return resolved_;
+        case State::Resolving:
+            return context.logErrorT(name_.getName()
+                                     + " has an endless loop of type define",
+                                     name_.getLoc());
+        case State::Unresolved:
+            break;
     }
 
-    if (parentName.find(name_.getName()) != parentName.end()) {
-        return context.logErrorT(name_.getName()
-                                 + " has an endless loop of type define",
-                                 name_.getLoc());
-    }
+    state_ = State::Resolving;
+    resolved_ = traverse(context);
+    state_ = State::Resolved;
 
-    parentName.insert(name_.getName());
-    auto type = context.typeOf(getLoc(), type_.getName(), parentName);
-    parentName.erase(name_.getName());
+    return resolved_;
+}
+
+llvm::Type *AST::ArrayType::traverse(CodeGenContext &context) {
+    auto type = context.typeOf(getLoc(), type_.getSymbol());
     if (!type) {
         return nullptr;
     }
 
-    type = llvm::PointerType::getUnqual(type);
-    context.types.push(name_.getName(), type);
-
-    return type;
+    return llvm::PointerType::getUnqual(type);
 }
 
-llvm::Type *AST::NameType::traverse(std::set<std::string> &parentName,
-                                    CodeGenContext &context) {
-    if (auto type = context.types[name_.getName()]) {
-        return type;
-    }
-
-    if (auto type = context.types[getName().getName()]) {
-        context.types.push(name_.getName(), type);
-        return type;
-    }
-
-    if (parentName.find(name_.getName()) != parentName.end()) {
-        return context.logErrorT(name_.getName() + " has an endless loop of type define",
-                                 name_.getLoc());
-    }
-
-    parentName.insert(name_.getName());
-
-    auto type = context.typeOf(getLoc(), type_.getName(), parentName);
-    parentName.erase(name_.getName());
-    return type;
+llvm::Type *AST::NameType::traverse(CodeGenContext &context) {
+    return context.typeOf(getLoc(), type_.getSymbol());
 }
 
-llvm::Type *AST::RecordType::traverse(std::set<std::string> &parentName,
-                                      CodeGenContext &context) {
-    if (context.types[name_.getName()]) {
-        return context.types[name_.getName()];
-    }
+llvm::Type *AST::RecordType::traverse(CodeGenContext &context) {
+    struct_ = llvm::StructType::create(context.context, name_.getName());
 
-    llvm::StructType::create(context.context, name_.getName());
+    return llvm::PointerType::getUnqual(struct_);
+}
 
+bool AST::RecordType::define(CodeGenContext &context) {
     std::vector<llvm::Type *> types;
     for (auto &field : fields_) {
-        auto type = context.typeOf(getLoc(), field->typeName_.getName(), parentName);
-        if (!type) return nullptr;
+        auto type = context.typeOf(getLoc(), field->typeName_.getSymbol());
+        if (!type) return false;
         field->type_ = type;
         types.push_back(type);
     }
 
-    auto *structType = context.module->getTypeByName(name_.getName());
-    structType->setBody(types);
+    struct_->setBody(types);
 
-    auto type = llvm::PointerType::getUnqual(structType);
-
-    context.types.push(name_.getName(), type);
-
-    return type;
+    return true;
 }
 
 bool Root::traverse(CodeGenContext &context) {
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
-
     auto targetTriple = llvm::sys::getDefaultTargetTriple();
     context.module->setTargetTriple(targetTriple);
 
@@ -689,16 +924,14 @@ bool Root::traverse(CodeGenContext &context) {
     auto target = llvm::TargetRegistry::lookupTarget(targetTriple, error);
 
     if (!target) {
-        llvm::errs() << error;
+        *context.errs << error;
         return false;
     }
 
-    auto CPU = "generic";
-    auto features = "";
-
     llvm::TargetOptions opt;
     auto RM = llvm::Optional<llvm::Reloc::Model>();
-    context.targetMachine = target->createTargetMachine(targetTriple, CPU, features, opt, RM);
+    context.targetMachine = target->createTargetMachine(targetTriple, context.cpu, context.features,
+                                                        opt, RM, llvm::None, context.codeGenOptLevel);
 
     context.module->setDataLayout(context.targetMachine->createDataLayout());
 
@@ -714,31 +947,22 @@ bool Root::traverse(CodeGenContext &context) {
                                                            "main"));
 
     auto block = llvm::BasicBlock::Create(context.context, "entry", context.mainFunction);
-    context.types["int"] = context.intType;
-    context.types["string"] = context.stringType;
+    context.types.push(Symbol("int"), context.intType);
+    context.types.push(Symbol("string"), context.stringType);
     context.intrinsic();
 
-    traverse(mainVariableTable_, context);
+    Node::traverse(mainVariableTable_, context);
 
     if (context.hasError) {
         return false;
     }
 
-    context.valueDecs.reset();
-    context.functionDecs.reset();
-    context.builder.SetInsertPoint(block);
-    std::vector<llvm::Type *> localVar;
-
-    for (auto &var : mainVariableTable_) {
-        localVar.push_back(var->getType());
-        context.valueDecs.push(var->getName(), var);
-    }
+    FunctionDec::lift(context.declaredFunctions, context.calls);
 
-    context.staticLink.front()->setBody(localVar);
-    context.currentFrame = context.createEntryBlockAlloca(context.mainFunction,
-                                                          context.staticLink.front(),
-                                                          "mainframe");
+    context.builder.SetInsertPoint(block);
     context.currentLevel = 0;
+    context.mainFrame = context.currentFrame =
+            context.createFrame(context.mainFunction, nullptr, mainVariableTable_);
 
     return !context.hasError;
 }
@@ -771,7 +995,7 @@ void StringExp::print(int depth) {
     string tabs = getTabs(depth);
 
     cout << tabs << "(" << endl;
-    cout << tabs << "StringExp: " << val_ << endl;
+    cout << tabs << "StringExp: " << val_.str() << endl;
     cout << tabs << ")" << endl;
 }
 
@@ -855,7 +1079,7 @@ void Identifier::print(int depth) {
     string tabs = getTabs(depth);
 
     cout << tabs << "(" << endl;
-    cout << tabs << "Identifier: " << name_ << endl;
+    cout << tabs << "Identifier: " << name_.getName() << endl;
     cout << tabs << ")" << endl;
 }
 
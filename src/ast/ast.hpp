@@ -1,10 +1,16 @@
 #ifndef AST_HPP
 #define AST_HPP
 
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Value.h>
+#include "ast/arena.hpp"
 #include "utils/codegencontext.hpp"
+#include "utils/linetable.hpp"
+#include "utils/symbol.hpp"
 #include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <set>
 #include <string>
@@ -18,7 +24,6 @@ namespace AST {
     using std::reverse;
     using std::set;
     using std::string;
-    using std::unique_ptr;
     using std::vector;
     using std::cout;
     using std::cerr;
@@ -28,74 +33,114 @@ namespace AST {
 
     class VarDec;
 
-    class Node {
-        size_t depth_ = 0;
+    class FunctionDec;
+
+    class RecordType;
+
+    class AstWriter;
 
+    class Node;
+
+    /*
+     * A node being traversed or generated. Programs nest to any depth, so
+     * "traverse" and "codegen" run the nodes from a heap stack of tasks: a step
+     * of the node on top either asks for a child, which is pushed and whose
+     * result is appended to "results" once it is done, or finishes the node.
+     * "step" counts the children asked for so far. The children run with the
+     * variable table of their parent, unless a step changes it.
+     */
+    template<typename Result>
+    struct Task {
+        Node *node;
+        unsigned step;
+        vector<VarDec *> *variableTable;
+        llvm::SmallVector<Result, 2> results;
+    };
+
+    /* Runs "step" over the tasks of "node" and of its subtree, returns the result of "node". */
+    template<typename Result, typename Step>
+    Result runTasks(Node *node, vector<VarDec *> *variableTable, Step step) {
+        vector<Task<Result>> tasks;
+        tasks.push_back({node, 0u, variableTable, {}});
+        for (;;) {
+            auto &task = tasks.back();
+            Node *child = nullptr;
+            auto result = step(task, child);
+            if (child) {
+                ++task.step;
+                auto childVariables = task.variableTable;
+                tasks.push_back({child, 0u, childVariables, {}});
+                continue;
+            }
+
+            tasks.pop_back();
+            if (tasks.empty()) {
+                return result;
+            }
+            tasks.back().results.push_back(result);
+        }
+    }
+
+    class Node {
     public:
         virtual ~Node() = default;
 
-        virtual Value *codegen(CodeGenContext &context) = 0;
+        /* Generates the node and its subtree from a heap stack, see Task. */
+        Value *codegen(CodeGenContext &context);
 
-        size_t &getDepth() {
-            return depth_;
-        }
+        /* Type checks the node and its subtree from a heap stack, see Task. */
+        llvm::Type *traverse(vector<VarDec *> &variableTable, CodeGenContext &context);
 
-        void setDepth(const size_t &depth) {
-            depth_ = depth;
-        }
+        /* One step of codegen: sets "child" to the next child to generate, or
+         * returns the value of the node once it is generated. */
+        virtual Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) = 0;
 
-        virtual llvm::Type *traverse(vector<VarDec *> &, CodeGenContext &) = 0;
+        /* One step of traverse: sets "child" to the next child to traverse, or
+         * returns the type of the node once it is traversed. */
+        virtual llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) = 0;
 
         virtual void print(int depth) = 0;
+
+        /* Serializes the node and its subtree, see astfile.hpp. */
+        virtual void write(AstWriter &writer) = 0;
     };
 
+    /* Byte offset of the first character of a construct, see LineTable. */
     class Location {
-        int first_line_;
-        int first_column_;
+        std::uint32_t offset_;
 
     public:
-        Location(int first_line, int first_column) :
-                first_line_(first_line), first_column_(first_column) {}
+        explicit Location(std::uint32_t offset) : offset_(offset) {}
 
-        virtual ~Location() = default;
-
-        int getFirstLine() const {
-            return first_line_;
-        }
-
-        int getFirstColumn() const {
-            return first_column_;
+        std::uint32_t getOffset() const {
+            return offset_;
         }
     };
 
 
-    class Identifier : public Node {
+    class Identifier {
         Location loc_;
-        string name_;
+        Symbol name_;
 
     public:
-        Identifier(Location loc, string name) :
+        Identifier(Location loc, Symbol name) :
                 loc_(move(loc)), name_(name) {}
 
-        virtual ~Identifier() = default;
-
         Location &getLoc() {
             return loc_;
         }
 
-        string &getName() {
-            return name_;
+        const string &getName() const {
+            return name_.getName();
         }
 
-        Value *codegen(CodeGenContext &context) override {
-            return nullptr;
+        Symbol getSymbol() const {
+            return name_;
         }
 
-        llvm::Type *traverse(vector<VarDec *> &vector, CodeGenContext &context) override {
-            return nullptr;
-        }
+        void print(int depth);
 
-        void print(int depth) override;
+        void write(AstWriter &writer);
     };
 
     class Var : public Node {
@@ -129,6 +174,8 @@ namespace AST {
     };
 
     class Root : public Node {
+        std::unique_ptr<Arena> arena_;
+        std::unique_ptr<LineTable> lineTable_;
         Location loc_;
         unique_ptr<Exp> root_;
         vector<VarDec *> mainVariableTable_;
@@ -137,10 +184,25 @@ namespace AST {
         Root(Location loc, unique_ptr<Exp> root) :
                 loc_(move(loc)), root_(move(root)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        /* The root keeps the arena that owns the nodes of the tree alive. */
+        void setArena(std::unique_ptr<Arena> arena) {
+            arena_ = move(arena);
+        }
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        void setLineTable(std::unique_ptr<LineTable> lineTable) {
+            lineTable_ = move(lineTable);
+        }
+
+        LineTable const &getLineTable() const {
+            return *lineTable_;
+        }
+
+        /* Generates the module from the program, after "traverse". */
+        Value *codegen(CodeGenContext &context);
+
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
+
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         Location &getLoc() {
             return loc_;
@@ -149,17 +211,24 @@ namespace AST {
         bool traverse(CodeGenContext &context);
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class Dec : public Node {
     protected:
         Location loc_;
         Identifier name_;
-        string concreteType_;
 
     public:
-        Dec(Location loc, Identifier name, string concreteType) :
-                loc_(move(loc)), name_(name), concreteType_(move(concreteType)) {}
+        enum class Kind {
+            Function,
+            Var,
+            Type
+        };
+
+        Dec(Location loc, Identifier name) :
+                loc_(move(loc)), name_(name) {}
 
         Location &getLoc() {
             return loc_;
@@ -178,17 +247,29 @@ namespace AST {
             return name_.getName();
         }
 
-        const string &getConcreteType() {
-            return concreteType_;
+        Symbol getSymbol() const {
+            return name_.getSymbol();
         }
+
+        virtual Kind getKind() const = 0;
     };
 
     class Type {
         Location loc_;
 
+        enum class State : std::uint8_t {
+            Unresolved, Resolving, Resolved
+        };
+
+        State state_{State::Unresolved};
+        /* The type of the declaration once resolved, nullptr when it is wrong. */
+        llvm::Type *resolved_{nullptr};
+
     protected:
         Identifier name_;
 
+        virtual llvm::Type *traverse(CodeGenContext &context) = 0;
+
     public:
         Type(Location loc, Identifier name) :
                 loc_(move(loc)), name_(name) {}
@@ -203,29 +284,43 @@ namespace AST {
 
         virtual ~Type() = default;
 
-        virtual llvm::Type *traverse(std::set<string> &parentName,
-                                     CodeGenContext &context) = 0;
+        /* Resolves the declaration once, its dependencies depth-first. A record
+         * is resolved to its struct without its fields, so a cycle found here
+         * does not go through a record and is an error. */
+        llvm::Type *resolve(CodeGenContext &context);
+
+        /* Resolves the types the resolved type is made of: the fields of a record. */
+        virtual bool define(CodeGenContext &) {
+            return true;
+        }
 
         Location &getLoc() {
             return loc_;
         }
 
         virtual void print(int depth) = 0;
+
+        virtual void write(AstWriter &writer) = 0;
     };
 
     class SimpleVar : public Var {
         Identifier name_;
+        /* The declaration found by traverse, codegen does not look it up again. */
+        VarDec *varDec_{nullptr};
 
     public:
         SimpleVar(Location loc, Identifier name) :
                 Var(move(loc)), name_(name) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        VarDec *getVarDec() const { return varDec_; }
+
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class FieldVar : public Var {
@@ -240,12 +335,13 @@ namespace AST {
                 : Var(move(loc)), var_(move(var)),
                   field_(move(field)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class SubscriptVar : public Var {
@@ -257,12 +353,13 @@ namespace AST {
         SubscriptVar(Location loc, unique_ptr<Var> var, unique_ptr<Exp> exp)
                 : Var(move(loc)), var_(move(var)), exp_(move(exp)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class VarExp : public Exp {
@@ -272,12 +369,13 @@ namespace AST {
         VarExp(Location loc, unique_ptr<Var> var) :
                 Exp(move(loc)), var_(move(var)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class NilExp : public Exp {
@@ -286,14 +384,15 @@ namespace AST {
         NilExp(Location loc) :
                 Exp(move(loc)) {};
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void setType(llvm::Type *type) { type_ = type; }
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class IntExp : public Exp {
@@ -303,32 +402,41 @@ namespace AST {
         IntExp(Location loc, int const &val) :
                 Exp(move(loc)), val_(val) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class StringExp : public Exp {
-        string val_;
+        llvm::StringRef val_;
 
     public:
-        StringExp(Location loc, string val) :
-                Exp(move(loc)), val_(move(val)) {}
+        StringExp(Location loc, llvm::StringRef val) :
+                Exp(move(loc)), val_(val) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class CallExp : public Exp {
         Identifier func_;
         vector<unique_ptr<Exp>> args_;
+        /* The callee found by traverse: a builtin, or a declaration whose
+         * function is created by codegen. */
+        llvm::Function *function_{nullptr};
+        FunctionDec *callee_{nullptr};
+        /* The level of the call and the number of variables declared before it. */
+        size_t level_{0u};
+        size_t declared_{0u};
 
     public:
         CallExp(Location loc, Identifier func,
@@ -337,12 +445,17 @@ namespace AST {
             reverse(args_.begin(), args_.end());
         }
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
+
+        /* Moves to their frames the captures of the callee that the call reads
+         * before they are declared, returns whether there were any. */
+        bool escapeUndeclared();
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
 // TODO: UnaryExp
@@ -373,18 +486,25 @@ namespace AST {
         unique_ptr<Exp> left_;
         unique_ptr<Exp> right_;
 
+        /* Type of this operation alone, its operands are already traversed. */
+        llvm::Type *checkOperands(llvm::Type *left, llvm::Type *right, CodeGenContext &context);
+
+        /* Value of this operation alone, its operands are already generated. */
+        Value *createOperation(Value *left, Value *right, CodeGenContext &context);
+
     public:
         BinaryExp(Location loc, Operator const &op,
                   unique_ptr<Exp> left, unique_ptr<Exp> right)
                 : Exp(move(loc)), op_(op),
                   left_(move(left)), right_(move(right)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class Field {
@@ -407,10 +527,14 @@ namespace AST {
 
         llvm::Type *getType() const { return type_; }
 
-        string &getName() {
+        const string &getName() {
             return name_.getName();
         }
 
+        Symbol getSymbol() const {
+            return name_.getSymbol();
+        }
+
         VarDec *getVar() const { return varDec_; }
 
         Location &getLoc() {
@@ -418,6 +542,8 @@ namespace AST {
         };
 
         void print(int depth);
+
+        void write(AstWriter &writer);
     };
 
     class FieldExp : public Exp {
@@ -435,31 +561,38 @@ namespace AST {
                   name_(name),
                   exp_(move(exp)) {}
 
-        string &getName() {
+        const string &getName() {
             return name_.getName();
         }
 
-        Value *codegen(CodeGenContext &context) override;
+        Symbol getSymbol() const {
+            return name_.getSymbol();
+        }
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
+
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class NameType : public Type {
         Identifier type_;
 
+    protected:
+        llvm::Type *traverse(CodeGenContext &context) override;
+
     public:
         NameType(Location loc, Identifier type) :
 
                 Type(move(loc), type),
                 type_(type) {}
 
-        llvm::Type *traverse(std::set<string> &parentName,
-                             CodeGenContext &context) override;
-
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class RecordExp : public Exp {
@@ -468,6 +601,8 @@ namespace AST {
         unique_ptr<NameType> typeName_;
         vector<unique_ptr<FieldExp>> fieldExps_;
         llvm::Type *type_{nullptr};
+        /* The declaration of the type, found before the fields are traversed. */
+        RecordType *typeDec_{nullptr};
 
     public:
         RecordExp(Location loc, unique_ptr<NameType> type,
@@ -477,13 +612,14 @@ namespace AST {
             reverse(fieldExps_.begin(), fieldExps_.end());
         }
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
 
+        void write(AstWriter &writer) override;
+
         const std::string getTypeName() {
             return typeName_->getName().getName();
         }
@@ -498,12 +634,13 @@ namespace AST {
             reverse(exps_.begin(), exps_.end());
         }
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class AssignExp : public Exp {
@@ -514,12 +651,13 @@ namespace AST {
         AssignExp(Location loc, unique_ptr<Var> var, unique_ptr<Exp> exp)
                 : Exp(move(loc)), var_(move(var)), exp_(move(exp)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class IfExp : public Exp {
@@ -533,12 +671,13 @@ namespace AST {
                 : Exp(move(loc)), test_(move(test)),
                   then_(move(then)), else_(move(elsee)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class WhileExp : public Exp {
@@ -549,12 +688,13 @@ namespace AST {
         WhileExp(Location loc, unique_ptr<Exp> test, unique_ptr<Exp> body)
                 : Exp(move(loc)), test_(move(test)), body_(move(body)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class DoWhileExp : public Exp {
@@ -565,12 +705,13 @@ namespace AST {
         DoWhileExp(Location loc, unique_ptr<Exp> body, unique_ptr<Exp> test)
                 : Exp(move(loc)), body_(move(body)), test_(move(test)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class ForExp : public Exp {
@@ -592,24 +733,26 @@ namespace AST {
                   high_(move(high)),
                   body_(move(body)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class BreakExp : public Exp {
     public:
         BreakExp(Location loc) : Exp(move(loc)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class LetExp : public Exp {
@@ -622,12 +765,13 @@ namespace AST {
             reverse(decs_.begin(), decs_.end());
         }
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class ArrayExp : public Exp {
@@ -640,13 +784,14 @@ namespace AST {
         ArrayExp(Location loc, unique_ptr<NameType> type, unique_ptr<Exp> size, unique_ptr<Exp> init)
                 : Exp(move(loc)), typeName_(move(type)), size_(move(size)), init_(move(init)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
 
+        void write(AstWriter &writer) override;
+
         const std::string getTypeName() {
             return typeName_->getName().getName();
         }
@@ -658,8 +803,13 @@ namespace AST {
         vector<unique_ptr<Field>> params_;
         Identifier result_;
         llvm::Type *resultType_{nullptr};
+        /* The type of the declared parameters, without the static link and the captures. */
+        llvm::FunctionType *type_{nullptr};
         llvm::Function *function_{nullptr};
-        VarDec *staticLink_{nullptr};
+        /* The type of the static link, the first parameter of the function: a
+         * pointer to the frame of the function that declares it. nullptr when
+         * the function reaches no enclosing frame. */
+        llvm::Type *staticLink_{nullptr};
         llvm::StructType *frame{nullptr};
 
     public:
@@ -672,12 +822,17 @@ namespace AST {
             reverse(params_.begin(), params_.end());
         }
 
-        llvm::Function *codegen(CodeGenContext &context);
+        /* Creates the function: the static link, then the values of "captures", then the parameters. */
+        llvm::Function *codegen(CodeGenContext &context, llvm::ArrayRef<VarDec *> captures);
 
-        string &getName() {
+        const string &getName() {
             return name_.getName();
         }
 
+        Symbol getSymbol() const {
+            return name_.getSymbol();
+        }
+
         void rename(Identifier name) {
             name_ = move(name);
         }
@@ -686,6 +841,8 @@ namespace AST {
 
         llvm::Type *getResultType() const { return resultType_; }
 
+        llvm::FunctionType *getType() const { return type_; }
+
         llvm::FunctionType *traverse(vector<VarDec *> &variableTable,
                                      CodeGenContext &context);
 
@@ -693,7 +850,9 @@ namespace AST {
 
         llvm::Function *getFunction() const { return function_; }
 
-        VarDec *getStaticLink() const { return staticLink_; }
+        llvm::Type *getStaticLink() const { return staticLink_; }
+
+        void dropStaticLink() { staticLink_ = nullptr; }
 
         Location &getLoc() {
             return loc_;
@@ -704,6 +863,8 @@ namespace AST {
         }
 
         void print(int depth);
+
+        void write(AstWriter &writer);
     };
 
     class FunctionDec : public Dec {
@@ -711,16 +872,36 @@ namespace AST {
         unique_ptr<Exp> body_;
         vector<VarDec *> variableTable_;
         size_t level_{0u};
+        /* The function that declares this one, nullptr at the top level. */
+        FunctionDec *parent_{nullptr};
+        /* The functions whose bodies call this one. */
+        llvm::SmallSetVector<FunctionDec *, 4> callers_;
+        /* The variables of the enclosing functions that this one or a function
+         * it calls reads and that are never assigned outside of their level:
+         * their values are passed as arguments after the static link. */
+        llvm::SmallSetVector<VarDec *, 4> captures_;
+        /* The lowest level whose frame this function reaches through its
+         * static link, it needs none when it is above "level_". */
+        size_t outerLevel_{SIZE_MAX};
+
+        bool reach(size_t level);
+
+        /* Flows the captures and the reached frames to the callers and the
+         * enclosing functions, see lift. */
+        static void propagate(vector<FunctionDec *> const &functions);
 
     public:
         FunctionDec(Location loc, Identifier name,
                     unique_ptr<Prototype> proto, unique_ptr<Exp> body)
-                : Dec(move(loc), move(name), "FunctionDec"), proto_(move(proto)), body_(move(body)) {}
+                : Dec(move(loc), move(name)), proto_(move(proto)), body_(move(body)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
+
+        Kind getKind() const override {
+            return Kind::Function;
+        }
 
         Prototype &getProto() const {
             return *proto_;
@@ -730,8 +911,22 @@ namespace AST {
             return level_;
         }
 
+        llvm::ArrayRef<VarDec *> getCaptures() const { return captures_.getArrayRef(); }
+
+        void calledBy(FunctionDec *caller) { callers_.insert(caller); }
+
+        /* Adds "var" to the captures when it is declared outside of this function. */
+        bool capture(VarDec *var);
+
+        /* Lambda lifting: computes the captures and the static link of
+         * "functions", every function declared by the program, "calls" are
+         * the calls to them. */
+        static void lift(vector<FunctionDec *> const &functions, vector<CallExp *> const &calls);
+
         void print(int depth) override;
 
+        void write(AstWriter &writer) override;
+
         bool computeHeaderTraverse(vector<VarDec *> &vector,
                                    CodeGenContext &context) override;
 
@@ -746,30 +941,64 @@ namespace AST {
         size_t offset_;
         size_t level_;
         llvm::Type *type_{nullptr};
+        /* The alloca of a variable that does not escape, set when its declaration
+         * is generated, or its copy in the function that captures it. */
+        llvm::Value *value_{nullptr};
         bool global{false};
+        /* Assigned by a function nested in the one that declares it, so it
+         * lives in the frame of that function, at "offset_". */
+        bool escaping_{false};
+        /* How many variables were declared up to this one, 0 for parameters and
+         * loop variables, which are set before any code that reads them. */
+        size_t declared_{0u};
 
     public:
         VarDec(Location loc, Identifier name, unique_ptr<NameType> type, unique_ptr<Exp> init)
-                : Dec(move(loc), move(name), "VarDec"), typeName_(move(type)), init_(move(init)) {}
+                : Dec(move(loc), move(name)), typeName_(move(type)), init_(move(init)) {}
 
         VarDec(Location loc, Identifier name, llvm::Type *type, size_t const &offset,
                size_t const &level)
-                : Dec(move(loc), move(name), "VarDec"), offset_(offset), level_(level), type_(type) {}
+                : Dec(move(loc), move(name)), offset_(offset), level_(level), type_(type) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
 
         llvm::Type *getType() const { return type_; }
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        size_t getLevel() const { return level_; }
+
+        bool isEscaping() const { return escaping_; }
+
+        size_t getDeclared() const { return declared_; }
+
+        llvm::Value *getValue() const { return value_; }
+
+        void setValue(llvm::Value *value) { value_ = value; }
+
+        void escape() { escaping_ = true; }
+
+        void setOffset(size_t offset) { offset_ = offset; }
+
+        /* Creates the storage of the variable in the current function, returns its address. */
+        llvm::Value *allocate(CodeGenContext &context);
+
+        /* The address of the variable from the current function. */
+        llvm::Value *address(CodeGenContext &context);
+
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
 
+        void write(AstWriter &writer) override;
+
         bool computeHeaderTraverse(vector<VarDec *> &vector,
                                    CodeGenContext &context) override;
 
         llvm::Value *computeHeaderCodegen(CodeGenContext &context) override;
 
+        Kind getKind() const override {
+            return Kind::Var;
+        }
+
         bool isGlobal() {
             return global;
         }
@@ -782,15 +1011,23 @@ namespace AST {
         TypeDec(Location loc,
                 Identifier name,
                 unique_ptr<Type> type)
-                : Dec(move(loc), move(name), "TypeDec"), type_(move(type)) {}
+                : Dec(move(loc), move(name)), type_(move(type)) {}
 
-        Value *codegen(CodeGenContext &context) override;
+        Kind getKind() const override {
+            return Kind::Type;
+        }
 
-        llvm::Type *traverse(vector<VarDec *> &variableTable,
-                             CodeGenContext &context) override;
+        /* Resolves the type and its fields, once the types of the let are declared. */
+        bool resolve(CodeGenContext &context);
+
+        Value *codegenStep(Task<Value *> &task, CodeGenContext &context, Node *&child) override;
+
+        llvm::Type *traverseStep(Task<llvm::Type *> &task, CodeGenContext &context, Node *&child) override;
 
         void print(int depth) override;
 
+        void write(AstWriter &writer) override;
+
         bool computeHeaderTraverse(vector<VarDec *> &vector,
                                    CodeGenContext &context) override;
 
@@ -803,31 +1040,37 @@ namespace AST {
         friend class FieldVar;
 
         vector<unique_ptr<Field>> fields_;
+        llvm::StructType *struct_{nullptr};
+
+    protected:
+        llvm::Type *traverse(CodeGenContext &context) override;
 
     public:
+        bool define(CodeGenContext &context) override;
+
         RecordType(Location loc, vector<unique_ptr<Field>> fields) :
-                Type(move(loc), Identifier(loc, "")), fields_(move(fields)) {
+                Type(move(loc), Identifier(loc, Symbol())), fields_(move(fields)) {
             reverse(fields_.begin(), fields_.end());
         }
 
-        llvm::Type *traverse(std::set<string> &parentName,
-                             CodeGenContext &context) override;
-
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
     class ArrayType : public Type {
         Identifier type_;
 
     protected:
+        llvm::Type *traverse(CodeGenContext &context) override;
+
     public:
         ArrayType(Location loc, Identifier type) :
-                Type(move(loc), Identifier(loc, "")), type_(type) {}
-
-        llvm::Type *traverse(std::set<string> &parentName,
-                             CodeGenContext &context) override;
+                Type(move(loc), Identifier(loc, Symbol())), type_(type) {}
 
         void print(int depth) override;
+
+        void write(AstWriter &writer) override;
     };
 
 }  // namespace AST
@@ -0,0 +1,871 @@
+#include "ast/astfile.hpp"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/LEB128.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <cstring>
+
+namespace AST {
+    namespace {
+        char const magic[4] = {'T', 'A', 'S', 'T'};
+        std::uint8_t const version = 1;
+
+        enum class Tag : std::uint8_t {
+            Null,
+            SimpleVar,
+            FieldVar,
+            SubscriptVar,
+            VarExp,
+            NilExp,
+            IntExp,
+            StringExp,
+            CallExp,
+            BinaryExp,
+            FieldExp,
+            RecordExp,
+            SequenceExp,
+            AssignExp,
+            IfExp,
+            WhileExp,
+            DoWhileExp,
+            ForExp,
+            BreakExp,
+            LetExp,
+            ArrayExp,
+            FunctionDec,
+            VarDec,
+            TypeDec,
+            NameType,
+            RecordType,
+            ArrayType
+        };
+    }  // namespace
+
+    /*
+     * Encodes the nodes in a buffer and numbers the symbols as it meets them,
+     * the names are written before the nodes once the whole tree is encoded.
+     */
+    class AstWriter {
+        std::string nodes_;
+        llvm::DenseMap<std::uint32_t, std::uint32_t> indices_;
+        std::vector<Symbol> symbols_;
+
+        /* A node or an identifier to write. */
+        struct Pending {
+            Node *node;
+            Identifier *name;
+        };
+
+        std::vector<Pending> pending_;
+
+        static void bytes(std::string &out, llvm::StringRef text) {
+            number(out, text.size());
+            out.append(text.data(), text.size());
+        }
+
+        static void number(std::string &out, std::uint64_t value) {
+            std::uint8_t buffer[16];
+            auto size = llvm::encodeULEB128(value, buffer);
+            out.append(reinterpret_cast<char *>(buffer), size);
+        }
+
+        std::uint32_t index(Symbol symbol) {
+            auto inserted = indices_.try_emplace(symbol.getId(), symbols_.size());
+            if (inserted.second) {
+                symbols_.push_back(symbol);
+            }
+            return inserted.first->second;
+        }
+
+    public:
+        AstWriter() {
+            index(Symbol());
+        }
+
+        void tag(Tag tag) {
+            nodes_.push_back(static_cast<char>(tag));
+        }
+
+        void number(std::uint64_t value) {
+            number(nodes_, value);
+        }
+
+        void integer(std::int64_t value) {
+            std::uint8_t buffer[16];
+            auto size = llvm::encodeSLEB128(value, buffer);
+            nodes_.append(reinterpret_cast<char *>(buffer), size);
+        }
+
+        void text(llvm::StringRef text) {
+            bytes(nodes_, text);
+        }
+
+        void location(Location &loc) {
+            number(loc.getOffset());
+        }
+
+        void symbol(Symbol symbol) {
+            number(index(symbol));
+        }
+
+        template<typename T>
+        void optional(T *node) {
+            if (node) {
+                node->write(*this);
+            } else {
+                tag(Tag::Null);
+            }
+        }
+
+        /* Writes "node" once the node being written is, a null node as Null. */
+        void child(Node *node) {
+            pending_.push_back({node, nullptr});
+        }
+
+        /* Writes "name" once the children queued before it are. */
+        void child(Identifier &name) {
+            pending_.push_back({nullptr, &name});
+        }
+
+        /* The fields of a record or of a prototype do not nest, they are written at once. */
+        void element(Field *field) {
+            field->write(*this);
+        }
+
+        void element(Node *node) {
+            child(node);
+        }
+
+        template<typename T>
+        void list(vector<unique_ptr<T>> const &nodes) {
+            number(nodes.size());
+            for (auto &node : nodes) {
+                element(node.get());
+            }
+        }
+
+        /*
+         * Programs nest to any depth, so the nodes of the tree write their own
+         * fields and queue their children, which are written from a heap stack
+         * in the order they were queued.
+         */
+        void tree(Node *node) {
+            child(node);
+            while (!pending_.empty()) {
+                auto next = pending_.back();
+                pending_.pop_back();
+
+                auto queued = pending_.size();
+                if (next.name) {
+                    next.name->write(*this);
+                } else if (next.node) {
+                    next.node->write(*this);
+                } else {
+                    tag(Tag::Null);
+                }
+                std::reverse(pending_.begin() + queued, pending_.end());
+            }
+        }
+
+        bool save(llvm::StringRef source, std::string const &fileName) {
+            std::string header(magic, sizeof(magic));
+            header.push_back(static_cast<char>(version));
+            bytes(header, source);
+            number(header, symbols_.size());
+            for (auto symbol : symbols_) {
+                bytes(header, symbol.getName());
+            }
+
+            std::error_code EC;
+            llvm::raw_fd_ostream out(fileName, EC, llvm::sys::fs::F_None);
+            if (EC) {
+                return false;
+            }
+
+            out << header << nodes_;
+            out.close();
+
+            return !out.has_error();
+        }
+    };
+
+    /*
+     * Rebuilds the nodes in one pass over the file. A malformed file sets
+     * "failed_", after which every read returns a null value and the tree
+     * that is built is dropped.
+     */
+    class AstReader {
+        Arena &arena_;
+        std::uint8_t const *cur_;
+        std::uint8_t const *end_;
+        std::vector<Symbol> symbols_;
+        std::vector<Node *> children_;
+        bool failed_{false};
+
+        std::nullptr_t fail() {
+            failed_ = true;
+            cur_ = end_;
+            return nullptr;
+        }
+
+        std::uint64_t number() {
+            unsigned size;
+            char const *error = nullptr;
+            auto value = llvm::decodeULEB128(cur_, &size, end_, &error);
+            if (error) {
+                fail();
+                return 0;
+            }
+            cur_ += size;
+            return value;
+        }
+
+        /* Number of elements of a list, each element takes one byte at least. */
+        std::uint64_t count() {
+            auto count = number();
+            if (count > static_cast<std::uint64_t>(end_ - cur_)) {
+                fail();
+                return 0;
+            }
+            return count;
+        }
+
+        std::int64_t integer() {
+            unsigned size;
+            char const *error = nullptr;
+            auto value = llvm::decodeSLEB128(cur_, &size, end_, &error);
+            if (error) {
+                fail();
+                return 0;
+            }
+            cur_ += size;
+            return value;
+        }
+
+        Tag tag() {
+            if (cur_ == end_) {
+                fail();
+                return Tag::Null;
+            }
+            return static_cast<Tag>(*cur_++);
+        }
+
+        Location location() {
+            auto offset = number();
+            if (offset > UINT32_MAX) {
+                fail();
+            }
+            return Location(static_cast<std::uint32_t>(offset));
+        }
+
+        Symbol symbol() {
+            auto index = number();
+            if (index >= symbols_.size()) {
+                fail();
+                return Symbol();
+            }
+            return symbols_[index];
+        }
+
+        Identifier identifier() {
+            auto loc = location();
+            return Identifier(loc, symbol());
+        }
+
+        template<typename T, typename... Args>
+        T *make(Args &&... args) {
+            return arena_.make<T>(std::forward<Args>(args)...);
+        }
+
+        Field *field() {
+            auto loc = location();
+            auto name = identifier();
+            auto type = identifier();
+            return make<Field>(loc, name, type);
+        }
+
+        /* The AST constructors take their lists in the reverse order built by the parser. */
+        template<typename T, typename Read>
+        vector<unique_ptr<T>> list(Read read) {
+            vector<unique_ptr<T>> nodes(count());
+            for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+                it->reset(read());
+            }
+            return nodes;
+        }
+
+        NameType *nameType(bool optional = false) {
+            auto tag = this->tag();
+            if (tag == Tag::Null && optional) {
+                return nullptr;
+            }
+            if (tag != Tag::NameType) {
+                return fail();
+            }
+            auto loc = location();
+            return make<NameType>(loc, identifier());
+        }
+
+        /* A node whose children are being read, with the fields read before them. */
+        struct Pending {
+            Tag tag;
+            Location loc;
+            Identifier name{Location(0), Symbol()};
+            BinaryExp::Operator op{BinaryExp::ADD};
+            std::int64_t value{0};
+            llvm::StringRef text;
+            Type *type{nullptr};
+            Prototype *proto{nullptr};
+            std::size_t base{0};
+            std::uint64_t count{0};
+        };
+
+        /* Reads the fields of "node" that come before its children and their number. */
+        void open(Pending &node);
+
+        /* Builds "node" from its children, reads the fields that come after them. */
+        Node *close(Pending &node);
+
+        /* Child "index" of "node", which must be a T, or null if "optional". */
+        template<typename T>
+        T *child(Pending &node, std::uint64_t index, bool optional = false) {
+            auto child = children_[node.base + index];
+            auto cast = dynamic_cast<T *>(child);
+            if (!cast && (child || !optional)) {
+                fail();
+            }
+            return cast;
+        }
+
+        /* The "count" children of "node" from "first" on, in the reverse order the AST constructors take. */
+        template<typename T>
+        vector<unique_ptr<T>> children(Pending &node, std::uint64_t first, std::uint64_t count) {
+            vector<unique_ptr<T>> nodes(count);
+            for (auto it = nodes.rbegin(); it != nodes.rend(); ++it, ++first) {
+                it->reset(child<T>(node, first));
+            }
+            return nodes;
+        }
+
+    public:
+        AstReader(Arena &arena, llvm::StringRef data) :
+                arena_(arena),
+                cur_(reinterpret_cast<std::uint8_t const *>(data.begin())),
+                end_(reinterpret_cast<std::uint8_t const *>(data.end())) {}
+
+        bool failed() const {
+            return failed_;
+        }
+
+        bool atEnd() const {
+            return cur_ == end_;
+        }
+
+        llvm::StringRef text() {
+            auto size = number();
+            if (size > static_cast<std::uint64_t>(end_ - cur_)) {
+                fail();
+                return llvm::StringRef();
+            }
+            llvm::StringRef text(reinterpret_cast<char const *>(cur_), size);
+            cur_ += size;
+            return text;
+        }
+
+        void symbols() {
+            auto size = count();
+            symbols_.reserve(size);
+            for (std::uint64_t i = 0; i < size; ++i) {
+                symbols_.emplace_back(text());
+            }
+        }
+
+        Root *root() {
+            auto loc = location();
+            auto exp = dynamic_cast<Exp *>(tree());
+            if (failed_ || !exp) {
+                return nullptr;
+            }
+            return new Root(loc, unique_ptr<Exp>(exp));
+        }
+
+        Node *tree();
+
+        Type *type();
+    };
+
+    /*
+     * Programs nest to any depth, so the nodes are read with a heap stack of
+     * the nodes whose children are being read. The children are kept in
+     * "children_" until the last one of their node is read and it is built.
+     */
+    Node *AstReader::tree() {
+        std::vector<Pending> pending;
+        for (;;) {
+            Node *node = nullptr;
+            auto tag = this->tag();
+            if (tag != Tag::Null) {
+                auto loc = location();
+                pending.push_back({tag, loc});
+                pending.back().base = children_.size();
+                open(pending.back());
+                if (failed_) {
+                    return nullptr;
+                }
+                if (pending.back().count > 0) {
+                    continue;
+                }
+                node = close(pending.back());
+                pending.pop_back();
+            }
+
+            while (!failed_ && !pending.empty()) {
+                auto &top = pending.back();
+                children_.push_back(node);
+                if (children_.size() - top.base < top.count) {
+                    break;
+                }
+                node = close(top);
+                children_.resize(top.base);
+                pending.pop_back();
+            }
+
+            if (failed_) {
+                return nullptr;
+            }
+            if (pending.empty()) {
+                return node;
+            }
+        }
+    }
+
+    void AstReader::open(Pending &node) {
+        switch (node.tag) {
+            case Tag::SimpleVar:
+                node.name = identifier();
+                break;
+            case Tag::FieldVar:
+            case Tag::VarExp:
+                node.count = 1;
+                break;
+            case Tag::SubscriptVar:
+            case Tag::AssignExp:
+            case Tag::WhileExp:
+            case Tag::DoWhileExp:
+                node.count = 2;
+                break;
+            case Tag::NilExp:
+            case Tag::BreakExp:
+                break;
+            case Tag::IntExp:
+                node.value = integer();
+                break;
+            case Tag::StringExp:
+                node.text = text();
+                break;
+            case Tag::CallExp:
+                node.name = identifier();
+                node.count = count();
+                break;
+            case Tag::BinaryExp:
+                node.op = static_cast<BinaryExp::Operator>(number());
+                switch (node.op) {
+                    case BinaryExp::ADD:
+                    case BinaryExp::SUB:
+                    case BinaryExp::MUL:
+                    case BinaryExp::DIV:
+                    case BinaryExp::LTH:
+                    case BinaryExp::GTH:
+                    case BinaryExp::EQU:
+                    case BinaryExp::NEQU:
+                    case BinaryExp::LEQU:
+                    case BinaryExp::GEQU:
+                        break;
+                    default:
+                        fail();
+                }
+                node.count = 2;
+                break;
+            case Tag::FieldExp:
+                node.name = identifier();
+                node.count = 1;
+                break;
+            case Tag::RecordExp:
+                node.type = nameType();
+                node.count = count();
+                break;
+            case Tag::SequenceExp:
+                node.count = count();
+                break;
+            case Tag::IfExp:
+                node.count = 3;
+                break;
+            case Tag::ForExp:
+                node.name = identifier();
+                node.count = 3;
+                break;
+            case Tag::LetExp:
+                node.count = count() + 1;
+                break;
+            case Tag::ArrayExp:
+                node.type = nameType();
+                node.count = 2;
+                break;
+            case Tag::FunctionDec: {
+                node.name = identifier();
+                auto protoLoc = location();
+                auto protoName = identifier();
+                auto params = list<Field>([this] { return field(); });
+                auto result = identifier();
+                node.proto = make<Prototype>(protoLoc, protoName, std::move(params), result);
+                node.count = 1;
+                break;
+            }
+            case Tag::VarDec:
+                node.name = identifier();
+                node.type = nameType(true);
+                node.count = 1;
+                break;
+            case Tag::TypeDec:
+                node.name = identifier();
+                node.type = type();
+                break;
+            default:
+                fail();
+        }
+    }
+
+    Node *AstReader::close(Pending &node) {
+        auto loc = node.loc;
+
+        switch (node.tag) {
+            case Tag::SimpleVar:
+                return make<SimpleVar>(loc, node.name);
+            case Tag::FieldVar: {
+                auto var = child<Var>(node, 0);
+                return make<FieldVar>(loc, unique_ptr<Var>(var), identifier());
+            }
+            case Tag::SubscriptVar:
+                return make<SubscriptVar>(loc, unique_ptr<Var>(child<Var>(node, 0)),
+                                          unique_ptr<Exp>(child<Exp>(node, 1)));
+            case Tag::VarExp:
+                return make<VarExp>(loc, unique_ptr<Var>(child<Var>(node, 0)));
+            case Tag::NilExp:
+                return make<NilExp>(loc);
+            case Tag::IntExp:
+                return make<IntExp>(loc, static_cast<int>(node.value));
+            case Tag::StringExp:
+                return make<StringExp>(loc, arena_.copy(node.text));
+            case Tag::CallExp:
+                return make<CallExp>(loc, node.name, children<Exp>(node, 0, node.count));
+            case Tag::BinaryExp:
+                return make<BinaryExp>(loc, node.op,
+                                       unique_ptr<Exp>(child<Exp>(node, 0)),
+                                       unique_ptr<Exp>(child<Exp>(node, 1)));
+            case Tag::FieldExp:
+                return make<FieldExp>(loc, node.name, unique_ptr<Exp>(child<Exp>(node, 0)));
+            case Tag::RecordExp:
+                return make<RecordExp>(loc,
+                                       unique_ptr<NameType>(static_cast<NameType *>(node.type)),
+                                       children<FieldExp>(node, 0, node.count));
+            case Tag::SequenceExp:
+                return make<SequenceExp>(loc, children<Exp>(node, 0, node.count));
+            case Tag::AssignExp:
+                return make<AssignExp>(loc, unique_ptr<Var>(child<Var>(node, 0)),
+                                       unique_ptr<Exp>(child<Exp>(node, 1)));
+            case Tag::IfExp:
+                // the else branch of an if is optional
+                return make<IfExp>(loc,
+                                   unique_ptr<Exp>(child<Exp>(node, 0)),
+                                   unique_ptr<Exp>(child<Exp>(node, 1)),
+                                   unique_ptr<Exp>(child<Exp>(node, 2, true)));
+            case Tag::WhileExp:
+                return make<WhileExp>(loc, unique_ptr<Exp>(child<Exp>(node, 0)),
+                                      unique_ptr<Exp>(child<Exp>(node, 1)));
+            case Tag::DoWhileExp:
+                return make<DoWhileExp>(loc, unique_ptr<Exp>(child<Exp>(node, 0)),
+                                        unique_ptr<Exp>(child<Exp>(node, 1)));
+            case Tag::ForExp:
+                return make<ForExp>(loc, node.name,
+                                    unique_ptr<Exp>(child<Exp>(node, 0)),
+                                    unique_ptr<Exp>(child<Exp>(node, 1)),
+                                    unique_ptr<Exp>(child<Exp>(node, 2)));
+            case Tag::BreakExp:
+                return make<BreakExp>(loc);
+            case Tag::LetExp: {
+                auto decs = children<Dec>(node, 0, node.count - 1);
+                return make<LetExp>(loc, std::move(decs), unique_ptr<Exp>(child<Exp>(node, node.count - 1)));
+            }
+            case Tag::ArrayExp:
+                return make<ArrayExp>(loc,
+                                      unique_ptr<NameType>(static_cast<NameType *>(node.type)),
+                                      unique_ptr<Exp>(child<Exp>(node, 0)),
+                                      unique_ptr<Exp>(child<Exp>(node, 1)));
+            case Tag::FunctionDec:
+                return make<FunctionDec>(loc, node.name, unique_ptr<Prototype>(node.proto),
+                                         unique_ptr<Exp>(child<Exp>(node, 0)));
+            case Tag::VarDec:
+                return make<VarDec>(loc, node.name,
+                                    unique_ptr<NameType>(static_cast<NameType *>(node.type)),
+                                    unique_ptr<Exp>(child<Exp>(node, 0)));
+            case Tag::TypeDec:
+                return make<TypeDec>(loc, node.name, unique_ptr<Type>(node.type));
+            default:
+                return fail();
+        }
+    }
+
+    Type *AstReader::type() {
+        auto tag = this->tag();
+        auto loc = location();
+
+        switch (tag) {
+            case Tag::NameType:
+                return make<NameType>(loc, identifier());
+            case Tag::RecordType:
+                return make<RecordType>(loc, list<Field>([this] { return field(); }));
+            case Tag::ArrayType:
+                return make<ArrayType>(loc, identifier());
+            default:
+                return fail();
+        }
+    }
+
+    bool emitAst(Root &root, std::string const &fileName) {
+        AstWriter writer;
+        root.write(writer);
+
+        return writer.save(root.getLineTable().getSource(), fileName);
+    }
+
+    std::unique_ptr<Root> loadAst(FILE *in) {
+        auto buffer = llvm::MemoryBuffer::getOpenFile(fileno(in), "", -1, false);
+        if (!buffer) {
+            return nullptr;
+        }
+
+        auto data = (*buffer)->getBuffer();
+        if (data.size() <= sizeof(magic)
+            || std::memcmp(data.data(), magic, sizeof(magic)) != 0
+            || static_cast<std::uint8_t>(data[sizeof(magic)]) != version) {
+            return nullptr;
+        }
+
+        auto arena = std::make_unique<Arena>();
+        AstReader reader(*arena, data.drop_front(sizeof(magic) + 1));
+
+        auto lineTable = LineTable::copy(reader.text());
+        reader.symbols();
+        std::unique_ptr<Root> root(reader.root());
+        if (!lineTable || !root || !reader.atEnd()) {
+            return nullptr;
+        }
+
+        root->setArena(std::move(arena));
+        root->setLineTable(std::move(lineTable));
+
+        return root;
+    }
+
+    void Identifier::write(AstWriter &writer) {
+        writer.location(loc_);
+        writer.symbol(name_);
+    }
+
+    void Root::write(AstWriter &writer) {
+        writer.location(loc_);
+        writer.tree(root_.get());
+    }
+
+    void SimpleVar::write(AstWriter &writer) {
+        writer.tag(Tag::SimpleVar);
+        writer.location(getLoc());
+        name_.write(writer);
+    }
+
+    void FieldVar::write(AstWriter &writer) {
+        writer.tag(Tag::FieldVar);
+        writer.location(getLoc());
+        writer.child(var_.get());
+        writer.child(field_);
+    }
+
+    void SubscriptVar::write(AstWriter &writer) {
+        writer.tag(Tag::SubscriptVar);
+        writer.location(getLoc());
+        writer.child(var_.get());
+        writer.child(exp_.get());
+    }
+
+    void VarExp::write(AstWriter &writer) {
+        writer.tag(Tag::VarExp);
+        writer.location(getLoc());
+        writer.child(var_.get());
+    }
+
+    void NilExp::write(AstWriter &writer) {
+        writer.tag(Tag::NilExp);
+        writer.location(getLoc());
+    }
+
+    void IntExp::write(AstWriter &writer) {
+        writer.tag(Tag::IntExp);
+        writer.location(getLoc());
+        writer.integer(val_);
+    }
+
+    void StringExp::write(AstWriter &writer) {
+        writer.tag(Tag::StringExp);
+        writer.location(getLoc());
+        writer.text(val_);
+    }
+
+    void CallExp::write(AstWriter &writer) {
+        writer.tag(Tag::CallExp);
+        writer.location(getLoc());
+        func_.write(writer);
+        writer.list(args_);
+    }
+
+    void BinaryExp::write(AstWriter &writer) {
+        writer.tag(Tag::BinaryExp);
+        writer.location(getLoc());
+        writer.number(static_cast<std::uint8_t>(op_));
+        writer.child(left_.get());
+        writer.child(right_.get());
+    }
+
+    void Field::write(AstWriter &writer) {
+        writer.location(loc_);
+        name_.write(writer);
+        typeName_.write(writer);
+    }
+
+    void FieldExp::write(AstWriter &writer) {
+        writer.tag(Tag::FieldExp);
+        writer.location(getLoc());
+        name_.write(writer);
+        writer.child(exp_.get());
+    }
+
+    void NameType::write(AstWriter &writer) {
+        writer.tag(Tag::NameType);
+        writer.location(getLoc());
+        type_.write(writer);
+    }
+
+    void RecordExp::write(AstWriter &writer) {
+        writer.tag(Tag::RecordExp);
+        writer.location(getLoc());
+        typeName_->write(writer);
+        writer.list(fieldExps_);
+    }
+
+    void SequenceExp::write(AstWriter &writer) {
+        writer.tag(Tag::SequenceExp);
+        writer.location(getLoc());
+        writer.list(exps_);
+    }
+
+    void AssignExp::write(AstWriter &writer) {
+        writer.tag(Tag::AssignExp);
+        writer.location(getLoc());
+        writer.child(var_.get());
+        writer.child(exp_.get());
+    }
+
+    void IfExp::write(AstWriter &writer) {
+        writer.tag(Tag::IfExp);
+        writer.location(getLoc());
+        writer.child(test_.get());
+        writer.child(then_.get());
+        writer.child(else_.get());
+    }
+
+    void WhileExp::write(AstWriter &writer) {
+        writer.tag(Tag::WhileExp);
+        writer.location(getLoc());
+        writer.child(test_.get());
+        writer.child(body_.get());
+    }
+
+    void DoWhileExp::write(AstWriter &writer) {
+        writer.tag(Tag::DoWhileExp);
+        writer.location(getLoc());
+        writer.child(body_.get());
+        writer.child(test_.get());
+    }
+
+    void ForExp::write(AstWriter &writer) {
+        writer.tag(Tag::ForExp);
+        writer.location(getLoc());
+        var_.write(writer);
+        writer.child(low_.get());
+        writer.child(high_.get());
+        writer.child(body_.get());
+    }
+
+    void BreakExp::write(AstWriter &writer) {
+        writer.tag(Tag::BreakExp);
+        writer.location(getLoc());
+    }
+
+    void LetExp::write(AstWriter &writer) {
+        writer.tag(Tag::LetExp);
+        writer.location(getLoc());
+        writer.list(decs_);
+        writer.child(body_.get());
+    }
+
+    void ArrayExp::write(AstWriter &writer) {
+        writer.tag(Tag::ArrayExp);
+        writer.location(getLoc());
+        typeName_->write(writer);
+        writer.child(size_.get());
+        writer.child(init_.get());
+    }
+
+    void Prototype::write(AstWriter &writer) {
+        writer.location(loc_);
+        name_.write(writer);
+        writer.list(params_);
+        result_.write(writer);
+    }
+
+    void FunctionDec::write(AstWriter &writer) {
+        writer.tag(Tag::FunctionDec);
+        writer.location(loc_);
+        name_.write(writer);
+        proto_->write(writer);
+        writer.child(body_.get());
+    }
+
+    void VarDec::write(AstWriter &writer) {
+        writer.tag(Tag::VarDec);
+        writer.location(loc_);
+        name_.write(writer);
+        writer.optional(typeName_.get());
+        writer.child(init_.get());
+    }
+
+    void TypeDec::write(AstWriter &writer) {
+        writer.tag(Tag::TypeDec);
+        writer.location(loc_);
+        name_.write(writer);
+        type_->write(writer);
+    }
+
+    void RecordType::write(AstWriter &writer) {
+        writer.tag(Tag::RecordType);
+        writer.location(getLoc());
+        writer.list(fields_);
+    }
+
+    void ArrayType::write(AstWriter &writer) {
+        writer.tag(Tag::ArrayType);
+        writer.location(getLoc());
+        type_.write(writer);
+    }
+}  // namespace AST
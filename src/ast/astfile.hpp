@@ -0,0 +1,28 @@
+#ifndef ASTFILE_HPP
+#define ASTFILE_HPP
+
+#include "ast/ast.hpp"
+#include <cstdio>
+#include <memory>
+#include <string>
+
+/*
+ * ".tast" files: the AST of a program as the parser builds it, so that a
+ * program compiled many times (other -O levels, targets, ...) is scanned and
+ * parsed only once.
+ *
+ * A file holds a header, the source text (for the diagnostics), the names of
+ * the symbols and the nodes in pre-order. Every node is a tag byte followed by
+ * its location and its fields, integers are LEB128-encoded and symbols are
+ * indices into the names of the file. The header holds a format version,
+ * files of another version are rejected.
+ */
+namespace AST {
+    /* Writes the tree of "root", that must not be analysed yet, to "fileName". */
+    bool emitAst(Root &root, std::string const &fileName);
+
+    /* Loads the tree written by emitAst, nullptr when "in" is not a valid .tast file. */
+    std::unique_ptr<Root> loadAst(FILE *in);
+}  // namespace AST
+
+#endif  // ASTFILE_HPP
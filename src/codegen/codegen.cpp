@@ -2,23 +2,216 @@
 #include <iostream>
 #include <stack>
 #include <tuple>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+#include <atomic>
+#include <thread>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include "ast/ast.hpp"
 
+/* Runs the standard -O<n> function and module pipelines (mem2reg, instcombine,
+ * GVN, inlining, loop passes and vectorizers) over the whole module. */
+void optimizeModule(CodeGenContext &context) {
+    if (context.optLevel == 0) {
+        return;
+    }
+
+    llvm::PassManagerBuilder builder;
+    builder.OptLevel = context.optLevel;
+    builder.SizeLevel = 0;
+    builder.Inliner = llvm::createFunctionInliningPass(context.optLevel, 0, false);
+    builder.LoopVectorize = context.optLevel > 1;
+    builder.SLPVectorize = context.optLevel > 1;
+    builder.LibraryInfo = new llvm::TargetLibraryInfoImpl(llvm::Triple(context.module->getTargetTriple()));
+    context.targetMachine->adjustPassManager(builder);
+
+    llvm::legacy::FunctionPassManager fpm(context.module.get());
+    fpm.add(llvm::createTargetTransformInfoWrapperPass(context.targetMachine->getTargetIRAnalysis()));
+    builder.populateFunctionPassManager(fpm);
+
+    llvm::legacy::PassManager mpm;
+    mpm.add(llvm::createTargetTransformInfoWrapperPass(context.targetMachine->getTargetIRAnalysis()));
+    builder.populateModulePassManager(mpm);
+
+    fpm.doInitialization();
+    for (auto &function : *context.module) {
+        fpm.run(function);
+    }
+    fpm.doFinalization();
+
+    mpm.run(*context.module);
+}
+
+/* Links the runtime bitcode into the module and internalizes its definitions, so the
+ * builtins can be inlined and specialized at each call site. */
+bool linkRuntime(CodeGenContext &context) {
+    llvm::SMDiagnostic diagnostic;
+    auto runtime = llvm::parseIRFile(context.runtimeBitcode, diagnostic, context.context);
+
+    if (!runtime) {
+        diagnostic.print("tc", *context.errs);
+        return false;
+    }
+
+    std::set<std::string> runtimeSymbols;
+    for (auto &value : runtime->global_values()) {
+        if (!value.isDeclaration()) {
+            runtimeSymbols.insert(value.getName().str());
+        }
+    }
+
+    if (llvm::Linker::linkModules(*context.module, std::move(runtime), llvm::Linker::Flags::LinkOnlyNeeded)) {
+        *context.errs << "Could not link the runtime library: " << context.runtimeBitcode << "\n";
+        return false;
+    }
+
+    llvm::internalizeModule(*context.module, [&runtimeSymbols](const llvm::GlobalValue &value) {
+        return runtimeSymbols.count(value.getName().str()) == 0;
+    });
+
+    return true;
+}
+
+/* Partitions the module with SplitModule and emits the objects of the partitions into
+ * "objects" on parallel threads, each one with its own LLVMContext and TargetMachine. The partitions
+ * only depend on the number of partitions, so the objects are the same for any number
+ * of threads. */
+bool emitPartitions(CodeGenContext &context, std::vector<llvm::SmallVector<char, 0>> &objects) {
+    // SplitModule externalizes the local symbols, keep them away from the runtime and libc names
+    for (auto &value : context.module->global_values()) {
+        if (value.hasLocalLinkage()) {
+            value.setName("tiger." + value.getName());
+            value.setLinkage(llvm::GlobalValue::ExternalLinkage);
+            value.setVisibility(llvm::GlobalValue::HiddenVisibility);
+        }
+    }
+
+    std::vector<llvm::SmallVector<char, 0>> bitcodes;
+    llvm::SplitModule(std::move(context.module), context.codegenPartitions, [&bitcodes](std::unique_ptr<llvm::Module> part) {
+        bitcodes.emplace_back();
+        llvm::raw_svector_ostream out(bitcodes.back());
+        llvm::WriteBitcodeToFile(*part, out);
+    });
+
+    auto &machine = *context.targetMachine;
+    objects.resize(bitcodes.size());
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+
+    auto worker = [&]() {
+        size_t index;
+        while ((index = next++) < bitcodes.size()) {
+            llvm::LLVMContext partContext;
+            auto part = llvm::parseBitcodeFile(llvm::MemoryBufferRef(llvm::StringRef(bitcodes[index].data(),
+                                                                                     bitcodes[index].size()),
+                                                                     "partition"),
+                                               partContext);
+            if (!part) {
+                llvm::consumeError(part.takeError());
+                failed = true;
+                continue;
+            }
+
+            std::unique_ptr<llvm::TargetMachine> partMachine(
+                    machine.getTarget().createTargetMachine(machine.getTargetTriple().str(),
+                                                            machine.getTargetCPU(),
+                                                            machine.getTargetFeatureString(),
+                                                            machine.Options,
+                                                            machine.getRelocationModel(),
+                                                            machine.getCodeModel(),
+                                                            machine.getOptLevel()));
+
+            llvm::raw_svector_ostream dest(objects[index]);
+            llvm::legacy::PassManager pm;
+            if (partMachine->addPassesToEmitFile(pm, dest, nullptr, llvm::CGFT_ObjectFile)) {
+                failed = true;
+                continue;
+            }
+            pm.run(**part);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    auto threads = std::min<size_t>(objects.size(), std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    return !failed;
+}
+
+/* Writes the objects to unique temporary files, which are removed after the link, so
+ * concurrent tc runs never share an object file. */
+bool writeObjects(CodeGenContext &context, std::vector<llvm::SmallVector<char, 0>> const &objects) {
+    for (auto &object : objects) {
+        llvm::SmallString<128> path;
+        int fd;
+        if (auto EC = llvm::sys::fs::createTemporaryFile("tiger", "o", fd, path)) {
+            *context.errs << "Could not create the object file: " << EC.message() << "\n";
+            return false;
+        }
+        context.objectFiles.push_back(path.str().str());
+
+        llvm::raw_fd_ostream dest(fd, true);
+        dest.write(object.data(), object.size());
+        dest.close();
+
+        if (dest.has_error()) {
+            *context.errs << "Could not write the object file: " << path << "\n";
+            dest.clear_error();
+            return false;
+        }
+    }
+
+    return true;
+}
+
 llvm::Value *AST::Root::codegen(CodeGenContext &context) {
     llvm::legacy::PassManager pm;
 
 //    pm.add(llvm::createPrintModulePass(llvm::outs())); // to print IR text on stdout
 
-    root_->codegen(context);
+    {
+        PhaseTimer::Scope scope(context.timer, "generate IR");
+        root_->codegen(context);
+    }
     context.builder.CreateRet(llvm::ConstantInt::get(llvm::Type::getInt64Ty(context.context),
                                                      llvm::APInt(64, 0)));
 
 //    pm.run(*context.module); // to print IR text on stdout
 
-    if (llvm::verifyFunction(*context.mainFunction, &llvm::errs())) {
+    if (llvm::verifyFunction(*context.mainFunction, context.errs)) {
         return context.logErrorV("Generate fail");
     }
 
+    if (context.hasError) {
+        return nullptr;
+    }
+
+    if (!context.runtimeBitcode.empty()) {
+        PhaseTimer::Scope scope(context.timer, "link runtime");
+        if (!linkRuntime(context)) {
+            return context.logErrorV("Runtime library link failed");
+        }
+    }
+
+    {
+        PhaseTimer::Scope scope(context.timer, "optimize");
+        optimizeModule(context);
+    }
+
     if (!context.outputFileI.empty()) {
         std::error_code EC;
 
@@ -27,28 +220,58 @@ llvm::Value *AST::Root::codegen(CodeGenContext &context) {
         dest_txt.flush();
     }
 
-    std::error_code EC;
-    llvm::raw_fd_ostream dest(context.outputFileO, EC, llvm::sys::fs::F_None);
-
-    if (EC) {
-        llvm::errs() << "Could not open file: " << EC.message();
+    if (context.jit) {
         return nullptr;
     }
 
-    auto fileType = llvm::CGFT_ObjectFile;
-    if (context.targetMachine->addPassesToEmitFile(pm, dest, nullptr, fileType)) {
-        llvm::errs() << "TheTargetMachine can't emit a file of this type";
-        return nullptr;
+    std::vector<llvm::SmallVector<char, 0>> objects;
+
+    if (context.codegenPartitions > 1) {
+        PhaseTimer::Scope scope(context.timer, "emit object");
+        if (!emitPartitions(context, objects)) {
+            return context.logErrorV("Object emission failed");
+        }
+    } else {
+        objects.emplace_back();
+        llvm::raw_svector_ostream dest(objects.back());
+
+        auto fileType = llvm::CGFT_ObjectFile;
+        if (context.targetMachine->addPassesToEmitFile(pm, dest, nullptr, fileType)) {
+            *context.errs << "TheTargetMachine can't emit a file of this type";
+            return nullptr;
+        }
+
+        PhaseTimer::Scope scope(context.timer, "emit object");
+        pm.run(*context.module);
     }
 
-    pm.run(*context.module);
-    dest.flush();
+    if (!writeObjects(context, objects)) {
+        for (auto &object : context.objectFiles) {
+            llvm::sys::fs::remove(object);
+        }
+        return context.logErrorV("Object emission failed");
+    }
 
     return nullptr;
 }
 
-llvm::Value *AST::SimpleVar::codegen(CodeGenContext &context) {
-    auto var = context.namedValues[name_.getName()];
+llvm::Value *AST::Node::codegen(CodeGenContext &context) {
+    return runTasks<llvm::Value *>(this, nullptr, [&context](Task<llvm::Value *> &task, Node *&child) {
+        return task.node->codegenStep(task, context, child);
+    });
+}
+
+llvm::Value *AST::Root::codegenStep(Task<llvm::Value *> &task, CodeGenContext &, Node *&child) {
+    if (task.step == 0) {
+        child = root_.get();
+        return nullptr;
+    }
+
+    return task.results[0];
+}
+
+llvm::Value *AST::SimpleVar::codegenStep(Task<llvm::Value *> &, CodeGenContext &context, Node *&) {
+    auto var = varDec_->address(context);
 
     if (!var) {
         return context.logErrorV("Unknown variable name " + name_.getName());
@@ -57,11 +280,11 @@ llvm::Value *AST::SimpleVar::codegen(CodeGenContext &context) {
     return var;
 }
 
-llvm::Value *AST::IntExp::codegen(CodeGenContext &context) {
+llvm::Value *AST::IntExp::codegenStep(Task<llvm::Value *> &, CodeGenContext &context, Node *&) {
     return llvm::ConstantInt::get(context.context, llvm::APInt(64, val_));
 }
 
-llvm::Value *AST::BreakExp::codegen(CodeGenContext &context) {
+llvm::Value *AST::BreakExp::codegenStep(Task<llvm::Value *> &, CodeGenContext &context, Node *&) {
     context.builder.CreateBr(std::get<1>(context.loopStack.top()));
 
     context.builder.SetInsertPoint(llvm::BasicBlock::Create(context.context,
@@ -71,139 +294,137 @@ llvm::Value *AST::BreakExp::codegen(CodeGenContext &context) {
     return llvm::Constant::getNullValue(llvm::Type::getInt64Ty(context.context));
 }
 
-llvm::Value *AST::ForExp::codegen(CodeGenContext &context) {
-    context.namedValues.enter();
-    context.valueDecs.enter();
-
+llvm::Value *AST::ForExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
     auto *function = context.builder.GetInsertBlock()->getParent();
 
-    auto *alloca = context.createEntryBlockAlloca(function, varDec_->getType(),
-                                                  varDec_->getName());
-    auto low = low_->codegen(context);
-    if (!low) {
+    // the variable, the bounds, then the blocks of the loop
+    auto &values = task.results;
+    if (task.step == 0) {
+        values.push_back(varDec_->allocate(context));
+        child = low_.get();
         return nullptr;
     }
-    if (!low->getType()->isIntegerTy()) {
-        return context.logErrorV("loop lower bound should be integer");
-    }
 
-    context.builder.CreateStore(low, alloca);
+    auto var = values[0];
+    if (task.step == 1) {
+        auto low = values[1];
+        if (!low) {
+            return nullptr;
+        }
+        if (!low->getType()->isIntegerTy()) {
+            return context.logErrorV("loop lower bound should be integer");
+        }
+
+        context.builder.CreateStore(low, var);
 
-    auto high = high_->codegen(context);
-    if (!high) {
+        child = high_.get();
         return nullptr;
     }
-    if (!high->getType()->isIntegerTy()) {
-        return context.logErrorV("loop higher bound should be integer");
-    }
 
-    auto testBB = llvm::BasicBlock::Create(context.context, "test", function);
-    auto loopBB = llvm::BasicBlock::Create(context.context, "loop", function);
-    auto nextBB = llvm::BasicBlock::Create(context.context, "next", function);
-    auto afterBB = llvm::BasicBlock::Create(context.context, "after", function);
+    if (task.step == 2) {
+        auto high = values[2];
+        if (!high) {
+            return nullptr;
+        }
+        if (!high->getType()->isIntegerTy()) {
+            return context.logErrorV("loop higher bound should be integer");
+        }
 
-    context.loopStack.push({nextBB, afterBB});
-    context.builder.CreateBr(testBB);
-    context.builder.SetInsertPoint(testBB);
+        auto testBB = llvm::BasicBlock::Create(context.context, "test", function);
+        auto loopBB = llvm::BasicBlock::Create(context.context, "loop", function);
+        auto nextBB = llvm::BasicBlock::Create(context.context, "next", function);
+        auto afterBB = llvm::BasicBlock::Create(context.context, "after", function);
 
-    auto endCond = context.builder.CreateICmpSLE(context.builder.CreateLoad((llvm::Value *) alloca,
-                                                                            var_.getName()), high,
-                                                 "loopcond");
+        context.loopStack.push({nextBB, afterBB});
+        context.builder.CreateBr(testBB);
+        context.builder.SetInsertPoint(testBB);
 
-    context.builder.CreateCondBr(endCond, loopBB, afterBB);
+        auto endCond = context.builder.CreateICmpSLE(context.builder.CreateLoad(var,
+                                                                                var_.getName()), high,
+                                                     "loopcond");
 
-    context.builder.SetInsertPoint(loopBB);
+        context.builder.CreateCondBr(endCond, loopBB, afterBB);
 
-    auto oldVal = context.valueDecs[var_.getName()];
-    if (oldVal) {
-        context.valueDecs.popOne(var_.getName());
-    }
-    context.valueDecs.push(var_.getName(), varDec_);
+        context.builder.SetInsertPoint(loopBB);
 
-    auto oldValN = context.namedValues[var_.getName()];
-    if (oldValN) {
-        context.namedValues.popOne(var_.getName());
+        values.append({testBB, nextBB, afterBB});
+        child = body_.get();
+        return nullptr;
     }
-    context.namedValues.push(varDec_->getName(), alloca);
 
-    if (!body_->codegen(context)) {
+    if (!values.back()) {
         return nullptr;
     }
 
+    auto testBB = llvm::cast<llvm::BasicBlock>(values[3]);
+    auto nextBB = llvm::cast<llvm::BasicBlock>(values[4]);
+    auto afterBB = llvm::cast<llvm::BasicBlock>(values[5]);
+
     context.builder.CreateBr(nextBB);
 
     context.builder.SetInsertPoint(nextBB);
 
-    auto nextVar = context.builder.CreateAdd(context.builder.CreateLoad((llvm::Value *) alloca,
+    auto nextVar = context.builder.CreateAdd(context.builder.CreateLoad(var,
                                                                         var_.getName()),
                                              llvm::ConstantInt::get(context.context,
                                                                     llvm::APInt(64, 1)),
                                              "nextvar");
-    context.builder.CreateStore(nextVar, alloca);
+    context.builder.CreateStore(nextVar, var);
 
     context.builder.CreateBr(testBB);
 
     context.builder.SetInsertPoint(afterBB);
 
-    if (oldVal && oldValN) {
-        context.valueDecs[var_.getName()] = oldVal;
-        context.namedValues[var_.getName()] = oldValN;
-    } else {
-        context.valueDecs.popOne(var_.getName());
-        context.namedValues.popOne(var_.getName());
-    }
-
     context.loopStack.pop();
 
-    context.valueDecs.exit();
-    context.namedValues.exit();
-
     return llvm::Constant::getNullValue(llvm::Type::getInt64Ty(context.context));
 }
 
-llvm::Value *AST::SequenceExp::codegen(CodeGenContext &context) {
-    llvm::Value *last = llvm::Constant::getNullValue(context.nilType);
+llvm::Value *AST::SequenceExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step > 0 && !task.results.back()) {
+        return nullptr;
+    }
 
-    for (auto &exp : exps_) {
-        last = exp->codegen(context);
-        if (!last) {
-            return nullptr;
-        }
+    if (task.step < exps_.size()) {
+        child = exps_[task.step].get();
+        return nullptr;
     }
 
-    return last;
+    return exps_.empty() ? llvm::Constant::getNullValue(context.nilType) : task.results.back();
 }
 
-llvm::Value *AST::LetExp::codegen(CodeGenContext &context) {
-    context.valueDecs.enter();
-    context.namedValues.enter();
-    context.functionDecs.enter();
-
-    for (auto &dec : decs_) {
-        dec->computeHeaderCodegen(context);
-    }
-
-    for (auto &dec : decs_) {
-        if (!dec->codegen(context)) {
-            return nullptr;
+llvm::Value *AST::LetExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    auto step = task.step;
+    if (step == 0) {
+        for (auto &dec : decs_) {
+            dec->computeHeaderCodegen(context);
         }
     }
 
-    auto result = body_->codegen(context);
+    // the declarations, then the body
+    if (step > 0 && step <= decs_.size() && !task.results.back()) {
+        return nullptr;
+    }
 
-    context.functionDecs.exit();
-    context.namedValues.exit();
-    context.valueDecs.exit();
+    if (step <= decs_.size()) {
+        child = step < decs_.size() ? static_cast<Node *>(decs_[step].get()) : body_.get();
+        return nullptr;
+    }
 
-    return result;
+    return task.results.back();
 }
 
-llvm::Value *AST::NilExp::codegen(CodeGenContext &context) {
+llvm::Value *AST::NilExp::codegenStep(Task<llvm::Value *> &, CodeGenContext &context, Node *&) {
     return llvm::ConstantPointerNull::get(context.nilType);
 }
 
-llvm::Value *AST::VarExp::codegen(CodeGenContext &context) {
-    auto var = var_->codegen(context);
+llvm::Value *AST::VarExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        child = var_.get();
+        return nullptr;
+    }
+
+    auto var = task.results[0];
     if (!var) {
         return nullptr;
     }
@@ -211,13 +432,23 @@ llvm::Value *AST::VarExp::codegen(CodeGenContext &context) {
     return context.builder.CreateLoad(var, var->getName());
 }
 
-llvm::Value *AST::AssignExp::codegen(CodeGenContext &context) {
-    auto var = var_->codegen(context);
+llvm::Value *AST::AssignExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        child = var_.get();
+        return nullptr;
+    }
+
+    auto var = task.results[0];
     if (!var) {
         return nullptr;
     }
 
-    auto exp = exp_->codegen(context);
+    if (task.step == 1) {
+        child = exp_.get();
+        return nullptr;
+    }
+
+    auto exp = task.results[1];
     if (!exp) {
         return nullptr;
     }
@@ -227,38 +458,62 @@ llvm::Value *AST::AssignExp::codegen(CodeGenContext &context) {
     return exp;
 }
 
-llvm::Value *AST::IfExp::codegen(CodeGenContext &context) {
-    auto test = test_->codegen(context);
-    if (!test) {
+llvm::Value *AST::IfExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        child = test_.get();
         return nullptr;
     }
 
-    test = context.builder.CreateICmpNE(test, context.zero, "iftest");
     auto function = context.builder.GetInsertBlock()->getParent();
 
-    auto thenBB = llvm::BasicBlock::Create(context.context, "then", function);
-    auto elseBB = llvm::BasicBlock::Create(context.context, "else");
-    auto mergeBB = llvm::BasicBlock::Create(context.context, "ifcont");
+    // the test, the else and merge blocks, the then branch and its last block, the else branch
+    auto &values = task.results;
+    if (task.step == 1) {
+        auto test = values[0];
+        if (!test) {
+            return nullptr;
+        }
+
+        test = context.builder.CreateICmpNE(test, context.zero, "iftest");
+
+        auto thenBB = llvm::BasicBlock::Create(context.context, "then", function);
+        auto elseBB = llvm::BasicBlock::Create(context.context, "else");
+        auto mergeBB = llvm::BasicBlock::Create(context.context, "ifcont");
 
-    context.builder.CreateCondBr(test, thenBB, elseBB);
+        context.builder.CreateCondBr(test, thenBB, elseBB);
 
-    context.builder.SetInsertPoint(thenBB);
+        context.builder.SetInsertPoint(thenBB);
 
-    auto then = then_->codegen(context);
+        values.append({elseBB, mergeBB});
+        child = then_.get();
+        return nullptr;
+    }
+
+    auto elseBB = llvm::cast<llvm::BasicBlock>(values[1]);
+    auto mergeBB = llvm::cast<llvm::BasicBlock>(values[2]);
+    auto then = values[3];
     if (!then) {
         return nullptr;
     }
 
-    context.builder.CreateBr(mergeBB);
+    if (task.step == 2) {
+        context.builder.CreateBr(mergeBB);
 
-    thenBB = context.builder.GetInsertBlock();
+        values.push_back(context.builder.GetInsertBlock());
 
-    function->getBasicBlockList().push_back(elseBB);
-    context.builder.SetInsertPoint(elseBB);
+        function->getBasicBlockList().push_back(elseBB);
+        context.builder.SetInsertPoint(elseBB);
+
+        if (else_) {
+            child = else_.get();
+            return nullptr;
+        }
+    }
 
-    llvm::Value *elsee;
+    auto thenBB = llvm::cast<llvm::BasicBlock>(values[4]);
+    llvm::Value *elsee = nullptr;
     if (else_) {
-        elsee = else_->codegen(context);
+        elsee = values[5];
         if (!elsee) {
             return nullptr;
         }
@@ -278,34 +533,55 @@ llvm::Value *AST::IfExp::codegen(CodeGenContext &context) {
         PN->addIncoming(elsee, elseBB);
 
         return PN;
+    } else {
+        return llvm::Constant::getNullValue(llvm::Type::getInt64Ty(context.context));
     }
-
-    return llvm::Constant::getNullValue(llvm::Type::getInt64Ty(context.context));
 }
 
-llvm::Value *generateWhileLoop(CodeGenContext &context,
-                               std::unique_ptr<AST::Exp> &test,
-                               std::unique_ptr<AST::Exp> &body) {
-    auto function = context.builder.GetInsertBlock()->getParent();
-    auto testBB = llvm::BasicBlock::Create(context.context, "test__", function);
-    auto loopBB = llvm::BasicBlock::Create(context.context, "loop", function);
-    auto nextBB = llvm::BasicBlock::Create(context.context, "next", function);
-    auto afterBB = llvm::BasicBlock::Create(context.context, "after", function);
+/* The steps of a while loop from "step" on, its blocks are kept in "values" from "base" on. */
+static llvm::Value *generateWhileLoop(CodeGenContext &context,
+                                      unsigned step,
+                                      llvm::SmallVectorImpl<llvm::Value *> &values,
+                                      size_t base,
+                                      AST::unique_ptr<AST::Exp> &test,
+                                      AST::unique_ptr<AST::Exp> &body,
+                                      AST::Node *&child) {
+    if (step == 0) {
+        auto function = context.builder.GetInsertBlock()->getParent();
+        auto testBB = llvm::BasicBlock::Create(context.context, "test__", function);
+        auto loopBB = llvm::BasicBlock::Create(context.context, "loop", function);
+        auto nextBB = llvm::BasicBlock::Create(context.context, "next", function);
+        auto afterBB = llvm::BasicBlock::Create(context.context, "after", function);
+
+        context.loopStack.push({nextBB, afterBB});
+        context.builder.CreateBr(testBB);
+        context.builder.SetInsertPoint(testBB);
+
+        values.append({testBB, loopBB, nextBB, afterBB});
+        child = test.get();
+        return nullptr;
+    }
 
-    context.loopStack.push({nextBB, afterBB});
-    context.builder.CreateBr(testBB);
-    context.builder.SetInsertPoint(testBB);
+    auto testBB = llvm::cast<llvm::BasicBlock>(values[base]);
+    auto loopBB = llvm::cast<llvm::BasicBlock>(values[base + 1]);
+    auto nextBB = llvm::cast<llvm::BasicBlock>(values[base + 2]);
+    auto afterBB = llvm::cast<llvm::BasicBlock>(values[base + 3]);
 
-    auto _test = test->codegen(context);
-    if (!_test) {
+    if (step == 1) {
+        auto _test = values[base + 4];
+        if (!_test) {
+            return nullptr;
+        }
+
+        auto EndCond = context.builder.CreateICmpEQ(_test, context.zero, "loopcond");
+        context.builder.CreateCondBr(EndCond, afterBB, loopBB);
+
+        context.builder.SetInsertPoint(loopBB);
+        child = body.get();
         return nullptr;
     }
 
-    auto EndCond = context.builder.CreateICmpEQ(_test, context.zero, "loopcond");
-    context.builder.CreateCondBr(EndCond, afterBB, loopBB);
-
-    context.builder.SetInsertPoint(loopBB);
-    if (!body->codegen(context)) {
+    if (!values[base + 5]) {
         return nullptr;
     }
 
@@ -318,53 +594,63 @@ llvm::Value *generateWhileLoop(CodeGenContext &context,
     return llvm::Constant::getNullValue(llvm::Type::getInt64Ty(context.context));
 }
 
-llvm::Value *AST::WhileExp::codegen(CodeGenContext &context) {
-    return generateWhileLoop(context, test_, body_);
+llvm::Value *AST::WhileExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    return generateWhileLoop(context, task.step, task.results, 0, test_, body_, child);
 }
 
-llvm::Value *AST::DoWhileExp::codegen(CodeGenContext &context) {
-    if (!body_->codegen(context)) {
+llvm::Value *AST::DoWhileExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    // the body once, then the loop
+    if (task.step == 0) {
+        child = body_.get();
         return nullptr;
     }
 
-    return generateWhileLoop(context, test_, body_);
-}
+    if (!task.results[0]) {
+        return nullptr;
+    }
 
-llvm::Value *AST::CallExp::codegen(CodeGenContext &context) {
-    auto callee = context.functionDecs[func_.getName()];
-    llvm::Function *function;
+    return generateWhileLoop(context, task.step - 1, task.results, 1, test_, body_, child);
+}
 
-    if (!callee) {
-        function = context.functions[func_.getName()];
-        if (!function) {
-            return context.logErrorV("Function "
-                                     + func_.getName()
-                                     + " not found");
+llvm::Value *AST::CallExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    // the arguments of the call are gathered in "args"
+    auto &args = task.results;
+    if (task.step == 0 && callee_) {
+        function_ = callee_->getProto().getFunction();
+        if (callee_->getProto().getStaticLink()) {
+            args.push_back(context.frameOf(callee_->getLevel()));
+        }
+        for (auto var : callee_->getCaptures()) {
+            args.push_back(context.builder.CreateLoad(var->address(context), var->getName()));
         }
-    } else {
-        function = callee->getProto().getFunction();
     }
 
-    std::vector<llvm::Value *> args;
-    for (size_t i = 0u; i != args_.size(); ++i) {
-        args.push_back(args_[i]->codegen(context));
-        if (!args.back()) {
-            return nullptr;
-        }
+    if (task.step > 0 && !args.back()) {
+        return nullptr;
+    }
+
+    if (task.step < args_.size()) {
+        child = args_[task.step].get();
+        return nullptr;
     }
 
-    if (function->getFunctionType()->getReturnType()->isVoidTy()) {
-        return context.builder.CreateCall(function, args);
+    if (function_->getFunctionType()->getReturnType()->isVoidTy()) {
+        return context.builder.CreateCall(function_, args);
     } else {
-        return context.builder.CreateCall(function, args, "calltmp");
+        return context.builder.CreateCall(function_, args, "calltmp");
     }
 }
 
-llvm::Value *AST::ArrayExp::codegen(CodeGenContext &context) {
+llvm::Value *AST::ArrayExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step < 2) {
+        child = task.step == 0 ? size_.get() : init_.get();
+        return nullptr;
+    }
+
     auto function = context.builder.GetInsertBlock()->getParent();
     auto eleType = context.getElementType(type_);
-    auto size = size_->codegen(context);
-    auto init = init_->codegen(context);
+    auto size = task.results[0];
+    auto init = task.results[1];
     auto eleSize = context.module->getDataLayout().getTypeAllocSize(eleType);
     llvm::Value *arrayPtr = context.builder
             .CreateCall(context.allocaArrayFunction,
@@ -424,9 +710,14 @@ llvm::Value *AST::ArrayExp::codegen(CodeGenContext &context) {
     return arrayPtr;
 }
 
-llvm::Value *AST::SubscriptVar::codegen(CodeGenContext &context) {
-    auto var = var_->codegen(context);
-    auto exp = exp_->codegen(context);
+llvm::Value *AST::SubscriptVar::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step < 2) {
+        child = task.step == 0 ? static_cast<Node *>(var_.get()) : exp_.get();
+        return nullptr;
+    }
+
+    auto var = task.results[0];
+    auto exp = task.results[1];
 
     if (!var) {
         return nullptr;
@@ -437,8 +728,13 @@ llvm::Value *AST::SubscriptVar::codegen(CodeGenContext &context) {
     return context.builder.CreateGEP(type_, var, exp, "ptr");
 }
 
-llvm::Value *AST::FieldVar::codegen(CodeGenContext &context) {
-    auto var = var_->codegen(context);
+llvm::Value *AST::FieldVar::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        child = var_.get();
+        return nullptr;
+    }
+
+    auto var = task.results[0];
     if (!var) {
         return nullptr;
     }
@@ -451,11 +747,16 @@ llvm::Value *AST::FieldVar::codegen(CodeGenContext &context) {
     return context.builder.CreateGEP(type_, var, idx, "ptr");
 }
 
-llvm::Value *AST::FieldExp::codegen(CodeGenContext &context) {
-    return exp_->codegen(context);
+llvm::Value *AST::FieldExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &, Node *&child) {
+    if (task.step == 0) {
+        child = exp_.get();
+        return nullptr;
+    }
+
+    return task.results[0];
 }
 
-llvm::Value *AST::RecordExp::codegen(CodeGenContext &context) {
+llvm::Value *AST::RecordExp::codegenStep(Task<llvm::Value *> &, CodeGenContext &context, Node *&) {
     return context.logErrorV("Sorry, record exp codegen is not working. You can use opt: \"-no-codegen\" to skip codegen phase.");
 
     llvm::Type *objType = context.module->getTypeByName(typeName_->getName().getName());
@@ -495,83 +796,109 @@ llvm::Value *AST::RecordExp::codegen(CodeGenContext &context) {
     return obj;
 }
 
-llvm::Value *AST::StringExp::codegen(CodeGenContext &context) {
+llvm::Value *AST::StringExp::codegenStep(Task<llvm::Value *> &, CodeGenContext &context, Node *&) {
     return context.builder.CreateGlobalStringPtr(val_, "str");
 }
 
-llvm::Function *AST::Prototype::codegen(CodeGenContext &) {
-    size_t idx = 0u;
-    for (auto &arg : function_->args()) {
-        arg.setName(params_[idx++]->getName());
+llvm::Function *AST::Prototype::codegen(CodeGenContext &context, llvm::ArrayRef<VarDec *> captures) {
+    std::vector<llvm::Type *> args;
+    if (staticLink_) {
+        args.push_back(staticLink_);
+    }
+    for (auto var : captures) {
+        args.push_back(var->getType());
     }
+    args.insert(args.end(), type_->param_begin(), type_->param_end());
 
-    return function_;
-}
+    function_ = llvm::Function::Create(llvm::FunctionType::get(resultType_, args, false),
+                                       llvm::Function::InternalLinkage,
+                                       getName(), context.module.get());
 
-llvm::Value *AST::FunctionDec::computeHeaderCodegen(CodeGenContext &context) {
-    if (context.functions.lookupOne(name_.getName())
-        && this->getConcreteType() == (context.lastDec ? context.lastDec->getConcreteType() : "")
-        && this->getName() == context.lastDec->getName()) {
-        return context.logErrorV("Function "
-                                 + name_.getName() +
-                                 " is already defined in same scope.");
+    auto arg = function_->arg_begin();
+    if (staticLink_) {
+        (arg++)->setName("staticlink");
     }
 
-    auto function = proto_->codegen(context);
-    if (!function) {
-        return nullptr;
+    for (auto var : captures) {
+        (arg++)->setName(var->getName());
     }
 
-    context.functionDecs.push(name_.getName(), this);
-    context.lastDec = this;
+    for (auto &param : params_) {
+        (arg++)->setName(param->getName());
+    }
 
-    return function;
+    return function_;
 }
 
-llvm::Value *AST::FunctionDec::codegen(CodeGenContext &context) {
-    auto function = proto_->getFunction();
+llvm::Value *AST::FunctionDec::computeHeaderCodegen(CodeGenContext &context) {
+    context.lastDec = this;
 
-    auto oldBB = context.builder.GetInsertBlock();
+    return proto_->codegen(context, getCaptures());
+}
 
-    auto BB = llvm::BasicBlock::Create(context.context, "entry", function);
-    context.builder.SetInsertPoint(BB);
+llvm::Value *AST::FunctionDec::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    auto function = proto_->getFunction();
 
-    context.valueDecs.enter();
-    context.namedValues.enter();
-    ++context.currentLevel;
+    // the block and the frame to return to, the values of the captures in the
+    // enclosing function, the display to restore, then the body
+    auto &saved = task.results;
+    if (task.step == 0) {
+        saved.push_back(context.builder.GetInsertBlock());
+        saved.push_back(context.currentFrame);
+
+        auto BB = llvm::BasicBlock::Create(context.context, "entry", function);
+        context.builder.SetInsertPoint(BB);
+
+        ++context.currentLevel;
+        context.staticLink.push_front(proto_->getFrame());
+
+        auto arg = function->arg_begin();
+        auto link = proto_->getStaticLink() ? &*arg++ : nullptr;
+        auto oldDisplay = context.display;
+        context.currentFrame = context.createFrame(function, link, variableTable_);
+
+        // the captured variables are copied like the parameters, their storage
+        // in the enclosing function is restored once the body is generated
+        for (auto var : captures_) {
+            saved.push_back(var->getValue());
+            context.builder.CreateStore(&*arg++, var->allocate(context));
+        }
 
-    size_t idx = 0;
-    for (auto &arg : function->args()) {
-        llvm::AllocaInst *alloca = context.createEntryBlockAlloca(function, arg.getType(), arg.getName());
-        context.builder.CreateStore(&arg, alloca);
+        for (auto &param : proto_->getParams()) {
+            context.builder.CreateStore(&*arg++, param->getVar()->allocate(context));
+        }
 
-        context.namedValues.push(arg.getName(), alloca);
-        context.valueDecs.push(arg.getName(), proto_->getParams()[idx++]->getVar());
+        saved.append(oldDisplay.begin(), oldDisplay.end());
+        child = body_.get();
+        return nullptr;
     }
 
-    if (auto retVal = body_->codegen(context)) {
+    auto generated = false;
+    if (auto retVal = saved.back()) {
         if (proto_->getResultType()->isVoidTy()) {
             context.builder.CreateRetVoid();
         } else {
             context.builder.CreateRet(retVal);
         }
 
-        if (!llvm::verifyFunction(*function, &llvm::errs())) {
-            context.valueDecs.exit();
-            context.namedValues.exit();
-            context.builder.SetInsertPoint(oldBB);
-            --context.currentLevel;
+        generated = !llvm::verifyFunction(*function, context.errs);
+    }
 
-            return function;
-        }
+    auto outerValues = saved.begin() + 2;
+    for (size_t i = 0u; i != captures_.size(); ++i) {
+        captures_[i]->setValue(outerValues[i]);
+    }
+    context.builder.SetInsertPoint(llvm::cast<llvm::BasicBlock>(saved[0]));
+    context.currentFrame = saved[1];
+    context.display.assign(outerValues + captures_.size(), saved.end() - 1);
+    context.staticLink.pop_front();
+    --context.currentLevel;
+
+    if (generated) {
+        return function;
     }
 
-    context.valueDecs.exit();
-    context.namedValues.exit();
     function->eraseFromParent();
-    context.functionDecs.popOne(name_.getName());
-    context.builder.SetInsertPoint(oldBB);
-    --context.currentLevel;
 
     return context.logErrorV("Function " + name_.getName() + " genteration failed");
 }
@@ -582,30 +909,37 @@ llvm::Value *AST::VarDec::computeHeaderCodegen(CodeGenContext &context) {
     return nullptr;
 }
 
-llvm::Value *AST::VarDec::codegen(CodeGenContext &context) {
-    auto value = context.namedValues.lookupOne(getName());
-    llvm::Value *var{nullptr};
-    if (value && ((llvm::PointerType *) value)->getElementType() == type_) {
-        var = value;
+llvm::Value *AST::VarDec::allocate(CodeGenContext &context) {
+    if (!escaping_) {
+        value_ = context.createEntryBlockAlloca(context.builder.GetInsertBlock()->getParent(),
+                                                type_, getName());
     }
 
-    auto init = init_->codegen(context);
-    if (!init) {
+    return address(context);
+}
+
+llvm::Value *AST::VarDec::address(CodeGenContext &context) {
+    if (!escaping_) {
+        return value_;
+    }
+
+    return context.builder.CreateStructGEP(context.frameOf(level_), offset_, getName());
+}
+
+llvm::Value *AST::VarDec::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step == 0) {
+        child = init_.get();
         return nullptr;
     }
 
-    if (!var) {
-        var = new llvm::GlobalVariable(*context.module, type_, false,
-                                       llvm::GlobalValue::ExternalLinkage,
-                                       (llvm::Constant *) llvm::ConstantInt::get(context.intType, llvm::APInt(8, 0)),
-                                       getName());
+    auto init = task.results[0];
+    if (!init) {
+        return nullptr;
     }
 
+    auto var = allocate(context);
     context.builder.CreateStore(init, var);
 
-    context.namedValues.push(getName(), var);
-    context.valueDecs.push(getName(), this);
-
     return var;
 }
 
@@ -615,7 +949,7 @@ llvm::Value *AST::TypeDec::computeHeaderCodegen(CodeGenContext &context) {
     return nullptr;
 }
 
-llvm::Value *AST::TypeDec::codegen(CodeGenContext &context) {
+llvm::Value *AST::TypeDec::codegenStep(Task<llvm::Value *> &, CodeGenContext &context, Node *&) {
     return llvm::Constant::getNullValue(llvm::Type::getInt64Ty(context.context));
 }
 
@@ -742,14 +1076,23 @@ llvm::Value *createXor(CodeGenContext &context, llvm::Value *L, llvm::Value *R)
     return context.builder.CreateXor(L, R, "xortmp");
 }
 
-llvm::Value *AST::BinaryExp::codegen(CodeGenContext &context) {
-    auto L = left_->codegen(context);
-    auto R = right_->codegen(context);
+llvm::Value *AST::BinaryExp::codegenStep(Task<llvm::Value *> &task, CodeGenContext &context, Node *&child) {
+    if (task.step < 2) {
+        child = task.step == 0 ? left_.get() : right_.get();
+        return nullptr;
+    }
+
+    auto L = task.results[0];
+    auto R = task.results[1];
 
     if (!L || !R) {
         return nullptr;
     }
 
+    return createOperation(L, R, context);
+}
+
+llvm::Value *AST::BinaryExp::createOperation(llvm::Value *L, llvm::Value *R, CodeGenContext &context) {
     switch (op_) {
         case ADD:
             return createAdd(context, L, R);
@@ -1,107 +1,542 @@
+#include <atomic>
+#include <chrono>
 #include <iostream>
-#include <string>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <string>
+#include <thread>
 #include "ast/ast.hpp"
+#include "ast/astfile.hpp"
 #include "tiger.parser.hpp"
+#include "utils/buildcache.hpp"
+#include "utils/jit.hpp"
+#include "utils/linker.hpp"
+#include "utils/runtimelib.hpp"
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Path.h>
 
 using std::cerr;
 using std::cin;
 using std::cout;
 using std::endl;
 
-extern YYSTYPE yylval;
-extern std::unique_ptr<AST::Root> root;
+bool syntacticAnalisys(FILE *in, std::unique_ptr<AST::Root> &root, CodeGenContext &context,
+                       std::ostream &out, std::ostream &err) {
+    {
+        PhaseTimer::Scope scope(context.timer, "syntactic analysis");
+        if (context.fromAst) {
+            root = AST::loadAst(in);
+        } else {
+            root = parse(in, context.parser == "pratt" ? ParserKind::Pratt : ParserKind::Bison, err);
+        }
+    }
 
-extern int yyparse(void); /* prototype for the syntaxing function */
+    if (root) {
+        context.lineTable = &root->getLineTable();
+        out << "Syntactic analysis successful!" << endl;
+    } else {
+        err << "Syntactic analysis failed" << endl;
+        return false;
+    }
 
-extern FILE *yyin;
+    return true;
+}
+
+bool semanticAnalisys(AST::Root &root, CodeGenContext &context, std::ostream &out, std::ostream &err) {
+    bool ok;
+    {
+        PhaseTimer::Scope scope(context.timer, "semantic analysis");
+        ok = root.traverse(context);
+    }
 
-void syntacticAnalisys() {
-    if (yyparse() == 0) {
-        cout << "Syntactic analysis successful!" << endl;
+    if (ok) {
+        out << "Semantic analysis successful!" << endl;
     } else {
-        cerr << "Syntactic analysis failed" << endl;
-        exit(EXIT_FAILURE);
+        err << "Semantic analysis failed" << endl;
+        return false;
     }
+
+    return true;
 }
 
-void semanticAnalisys(CodeGenContext &context) {
-    if (root) {
-        if (root->traverse(context)) {
-            cout << "Semantic analysis successful!" << endl;
-        } else {
-            cerr << "Semantic analysis failed" << endl;
+bool codegen(AST::Root &root, CodeGenContext &context, std::ostream &out, std::ostream &err) {
+    {
+        PhaseTimer::Scope scope(context.timer, "codegen");
+        root.codegen(context);
+    }
+
+    if (!context.hasError) {
+        out << "Codegen successful!" << endl;
+    } else {
+        err << "Codegen failed" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+void printABS(AST::Root &root) {
+    root.print(0);
+}
+
+bool executablegen(CodeGenContext &context, std::ostream &out, std::ostream &err) {
+    bool ok;
+    {
+        PhaseTimer::Scope scope(context.timer, "link");
+        ok = linkExecutable(context.linker, context.objectFiles, context.libs, context.outputFileE, err);
+    }
+
+    for (auto &object : context.objectFiles) {
+        llvm::sys::fs::remove(object);
+    }
+
+    if (ok) {
+        out << "Executable: \"" << context.outputFileE << "\" generated!" << endl;
+    } else {
+        err << "Executable: \"" << context.outputFileE << "\" not generated!" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+std::vector<std::string>::const_iterator findOption(const std::vector<std::string> &args,
+                                                    const std::string &prefix) {
+    return std::find_if(args.begin(),
+                        args.end(),
+                        [&prefix](const std::string &str) {
+                            return str.rfind(prefix, 0) == 0;
+                        });
+}
+
+bool jitrun(CodeGenContext &context, int &result, std::ostream &err) {
+    if (!runJIT(context, result)) {
+        err << "JIT execution failed" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+/* Applies the code generation options of the command line to "codeGenContext". */
+void configure(CodeGenContext &codeGenContext, const std::vector<std::string> &args) {
+    auto _O = std::find_if(args.begin(),
+                           args.end(),
+                           [](const std::string &str) {
+                               return str.size() == 3 && str.rfind("-O", 0) == 0;
+                           });
+    if (_O != args.end()) {
+        auto level = (*_O)[2] - '0';
+        if (level < 0 || level > 3) {
+            cerr << "Invalid optimization level: " << *_O << endl;
             exit(EXIT_FAILURE);
         }
+        codeGenContext.optLevel = level;
     }
-}
 
-void codegen(CodeGenContext &context) {
-    if (root) {
-        root->codegen(context);
+    if (std::find(args.begin(), args.end(), "-march=native") != args.end()) {
+        codeGenContext.useHostCPU(true);
+    }
 
-        if (!context.hasError) {
-            cout << "Codegen successful!" << endl;
+    auto _mcpu = findOption(args, "-mcpu=");
+    if (_mcpu != args.end()) {
+        auto cpu = _mcpu->substr(6);
+        if (cpu == "native") {
+            codeGenContext.useHostCPU(false);
         } else {
-            cerr << "Codegen failed" << endl;
+            codeGenContext.cpu = cpu;
+        }
+    }
+
+    auto _mattr = findOption(args, "-mattr=");
+    if (_mattr != args.end()) {
+        codeGenContext.addFeatures(_mattr->substr(7));
+    }
+
+    auto _codegenOpt = findOption(args, "-codegen-opt=");
+    if (_codegenOpt != args.end()) {
+        auto level = _codegenOpt->substr(13);
+        if (level == "0") {
+            codeGenContext.codeGenOptLevel = llvm::CodeGenOpt::None;
+        } else if (level == "1") {
+            codeGenContext.codeGenOptLevel = llvm::CodeGenOpt::Less;
+        } else if (level == "2") {
+            codeGenContext.codeGenOptLevel = llvm::CodeGenOpt::Default;
+        } else if (level == "3") {
+            codeGenContext.codeGenOptLevel = llvm::CodeGenOpt::Aggressive;
+        } else {
+            cerr << "Invalid backend optimization level: " << level << endl;
             exit(EXIT_FAILURE);
         }
     }
+
+    auto _partitions = findOption(args, "-codegen-partitions=");
+    if (_partitions != args.end()) {
+        auto partitions = atoi(_partitions->substr(20).c_str());
+        if (partitions < 1) {
+            cerr << "Invalid number of codegen partitions: " << _partitions->substr(20) << endl;
+            exit(EXIT_FAILURE);
+        }
+        codeGenContext.codegenPartitions = partitions;
+    }
+
+    auto _fuseLd = findOption(args, "-fuse-ld=");
+    if (_fuseLd != args.end()) {
+        codeGenContext.linker = _fuseLd->substr(9);
+        if (codeGenContext.linker != "ld"
+            && codeGenContext.linker != "lld"
+            && codeGenContext.linker != "clang++") {
+            cerr << "Invalid linker: " << codeGenContext.linker << endl;
+            exit(EXIT_FAILURE);
+        }
+#ifndef TIGER_LLD
+        if (codeGenContext.linker == "lld") {
+            cerr << "Warning: lld is not built in (qmake CONFIG+=lld), linking with ld" << endl;
+        }
+#endif
+    }
+
+    auto _parser = findOption(args, "-parser=");
+    if (_parser != args.end()) {
+        codeGenContext.parser = _parser->substr(8);
+        if (codeGenContext.parser != "bison" && codeGenContext.parser != "pratt") {
+            cerr << "Invalid parser: " << codeGenContext.parser << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    auto _emitAst = findOption(args, "-emit-ast=");
+    if (_emitAst != args.end()) {
+        codeGenContext.outputFileAst = _emitAst->substr(10);
+    }
+
+    codeGenContext.fromAst = std::find(args.begin(), args.end(), "-from-ast") != args.end();
+
+    auto _l = args.begin();
+    while ((_l = std::find_if(_l,
+                              args.end(),
+                              [](const std::string &str) {
+                                  return str.rfind("-l", 0) == 0;
+                              })) != args.end()) {
+        auto l = *(_l++);
+        codeGenContext.libs.push_back(l.substr(2, l.size()));
+    }
+
+    codeGenContext.jit = std::find(args.begin(), args.end(), "-run") != args.end();
 }
 
-void printABS() {
-    if (root) {
-        root->print(0);
+/* Runs every phase over "fname". Successes are reported on "out", failures and the errors of
+ * the phases on "err".
+ * With "-run", the exit code of the program is stored in "exitCode". */
+bool compile(const std::string &fname,
+             CodeGenContext &codeGenContext,
+             const std::vector<std::string> &args,
+             std::ostream &out,
+             std::ostream &err,
+             int *exitCode = nullptr) {
+    codeGenContext.setDiagnostics(err);
+
+    FILE *in = fopen(fname.c_str(), "r");
+    if (!in) {
+        err << "Cannot open file: " << fname << endl;
+        return false;
+    }
+
+    std::string cacheKey;
+    if (codeGenContext.cache
+        && codeGenContext.outputFileI.empty()
+        && codeGenContext.outputFileAst.empty()
+        && !codeGenContext.jit
+        && std::find(args.begin(), args.end(), "-a") == args.end()
+        && std::find(args.begin(), args.end(), "-no-codegen") == args.end()) {
+        PhaseTimer::Scope scope(codeGenContext.timer, "cache lookup");
+
+        std::vector<std::string> flags{llvm::sys::getDefaultTargetTriple(),
+                                       std::to_string(codeGenContext.optLevel),
+                                       codeGenContext.cpu,
+                                       codeGenContext.features,
+                                       std::to_string(codeGenContext.codeGenOptLevel),
+                                       std::to_string(codeGenContext.codegenPartitions),
+                                       codeGenContext.linker};
+        // the inlined runtime is hashed by contents like the libs, "ensure" may have rebuilt it
+        auto inputs = codeGenContext.libs;
+        if (!codeGenContext.runtimeBitcode.empty()) {
+            inputs.push_back(codeGenContext.runtimeBitcode);
+        }
+        cacheKey = codeGenContext.cache->key(fname, flags, inputs);
+
+        if (!cacheKey.empty() && codeGenContext.cache->fetch(cacheKey, codeGenContext.outputFileE)) {
+            fclose(in);
+            out << "Executable: \"" << codeGenContext.outputFileE << "\" generated! (cached)" << endl;
+            return true;
+        }
     }
+
+    std::unique_ptr<AST::Root> root;
+    bool parsed = syntacticAnalisys(in, root, codeGenContext, out, err);
+    fclose(in);
+
+    if (!parsed) {
+        return false;
+    }
+
+    if (!codeGenContext.outputFileAst.empty() && !AST::emitAst(*root, codeGenContext.outputFileAst)) {
+        err << "Cannot write the AST file: " << codeGenContext.outputFileAst << endl;
+        return false;
+    }
+
+    if (std::find(args.begin(), args.end(), "-a") != args.end()) {
+        printABS(*root);
+    }
+
+    if (!semanticAnalisys(*root, codeGenContext, out, err)) {
+        return false;
+    }
+
+    if (std::find(args.begin(), args.end(), "-no-codegen") == args.end()) {
+        if (!codegen(*root, codeGenContext, out, err)) {
+            return false;
+        }
+
+        if (codeGenContext.jit) {
+            int result;
+            if (!jitrun(codeGenContext, result, err)) {
+                return false;
+            }
+            if (exitCode) {
+                *exitCode = result;
+            }
+
+            return true;
+        }
+
+        if (!executablegen(codeGenContext, out, err)) {
+            return false;
+        }
+
+        if (!cacheKey.empty()) {
+            codeGenContext.cache->store(cacheKey, codeGenContext.outputFileE);
+        }
+    }
+
+    return true;
+}
+
+/* "-time-phases" prints the time of each phase, "-stats-json={{file}}" writes it as a Chrome trace. */
+bool reportTimes(PhaseTimer const &timer, const std::vector<std::string> &args) {
+    if (std::find(args.begin(), args.end(), "-time-phases") != args.end()) {
+        timer.printTable(cerr);
+    }
+
+    auto _statsJson = findOption(args, "-stats-json=");
+    if (_statsJson != args.end()) {
+        return timer.writeTrace(_statsJson->substr(12));
+    }
+
+    return true;
 }
 
-void executablegen(CodeGenContext &context) {
-    std::stringstream ss;
+/* Compiles every file of "files" on "jobs" threads, each one with its own CodeGenContext,
+ * and reports the status of each file and the throughput of the batch. */
+bool batch(const std::vector<std::string> &files,
+           const std::vector<std::string> &args,
+           unsigned jobs,
+           CodeGenContext const &defaults) {
+    auto _o = std::find(args.begin(), args.end(), "-o");
+    auto _i = std::find(args.begin(), args.end(), "-i");
+    std::string outputDir = _o != args.end() ? *(_o + 1) : "";
+    std::string irDir = _i != args.end() ? *(_i + 1) : "";
+    std::string astDir = defaults.outputFileAst;
+
+    std::vector<std::string> outputs;
+    std::set<std::string> uniqueOutputs;
+    for (auto &fname : files) {
+        llvm::SmallString<128> output(outputDir.empty()
+                                      ? llvm::sys::path::parent_path(fname)
+                                      : llvm::StringRef(outputDir));
+        llvm::sys::path::append(output, llvm::sys::path::stem(fname));
+        outputs.push_back(output.str().str());
 
-    ss << "clang++ " << context.outputFileO << " ";
-    for (const auto &lib : context.libs) {
-        ss << lib << " ";
+        if (!uniqueOutputs.insert(outputs.back()).second) {
+            cerr << "More than one file would generate \"" << outputs.back() << "\"" << endl;
+            return false;
+        }
     }
-    ss << "-o " << context.outputFileE;
 
-    if (system(ss.str().c_str()) == 0) {
-        cout << "Executable: \"" << context.outputFileE << "\" generated!" << endl;
-    } else {
-        cerr << "Executable: \"" << context.outputFileE << "\" not generated!" << endl;
-        exit(EXIT_FAILURE);
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> failed{0};
+    std::mutex reportMutex;
+    PhaseTimer timer;
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto worker = [&](unsigned tid) {
+        size_t index;
+        while ((index = next++) < files.size()) {
+            auto &fname = files[index];
+
+            CodeGenContext codeGenContext;
+            configure(codeGenContext, args);
+            codeGenContext.timer.file = fname;
+            codeGenContext.timer.tid = tid;
+            codeGenContext.cache = defaults.cache;
+            codeGenContext.runtimeBitcode = defaults.runtimeBitcode;
+            codeGenContext.libs = defaults.libs;
+            codeGenContext.outputFileE = outputs[index];
+            if (!irDir.empty()) {
+                llvm::SmallString<128> ir(irDir);
+                llvm::sys::path::append(ir, llvm::sys::path::stem(fname) + ".ll");
+                codeGenContext.outputFileI = ir.str().str();
+            }
+            if (!astDir.empty()) {
+                llvm::SmallString<128> ast(astDir);
+                llvm::sys::path::append(ast, llvm::sys::path::stem(fname) + ".tast");
+                codeGenContext.outputFileAst = ast.str().str();
+            }
+
+            std::ostringstream out, err;
+            bool ok = compile(fname, codeGenContext, args, out, err);
+            if (!ok) {
+                failed++;
+            }
+
+            std::lock_guard<std::mutex> lock(reportMutex);
+            timer.append(codeGenContext.timer);
+            cout << fname << ": " << (ok ? "ok" : "failed") << endl;
+            // every error of the file under its name, the threads do not write to std::cerr
+            std::istringstream errors(err.str());
+            std::string line;
+            while (std::getline(errors, line)) {
+                cout << "    " << line << endl;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < jobs; i++) {
+        workers.emplace_back(worker, i);
+    }
+    for (auto &thread : workers) {
+        thread.join();
     }
 
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    cout << files.size() - failed << "/" << files.size() << " files compiled in "
+         << elapsed << " s (" << files.size() / elapsed << " files/s, " << jobs << " jobs)" << endl;
+
+    return reportTimes(timer, args) && failed == 0;
 }
 
 int main(int argc, char **argv) {
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmPrinter();
-    llvm::InitializeNativeTargetAsmParser();
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargets();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmParsers();
+    llvm::InitializeAllAsmPrinters();
 
     std::string fname;
     CodeGenContext codeGenContext;
 
     std::vector<std::string> args(argv, argv + argc);
 
+    auto _j = findOption(args, "-j");
+
+    std::vector<std::string> files;
+    for (size_t i = 1; i < args.size(); i++) {
+        if (args[i] == "-p" || args[i] == "-i" || args[i] == "-o") {
+            i++;
+        } else if (args[i][0] != '-') {
+            files.push_back(args[i]);
+        }
+    }
+
     if (args.size() < 3 ||
-        std::find(args.begin(), args.end(), "-p") == args.end()) {
+        (std::find(args.begin(), args.end(), "-p") == args.end() && (_j == args.end() || files.empty()))) {
         cerr << "Usage: <executable> -p filename" << endl
+             << "       <executable> -j[N] filename..." << endl
              << "opts: \"-p {{path to the file with Tiger code}}\" : specifies the path of the file with Tiger code to be compiled" << endl
+             << "      \"-j[N] {{files}}\" : compile all the files on N threads (default: one per core), \"-o\" and \"-i\" are then output directories" << endl
              << "      \"-a\" : print generated ABS for \"-p\" file" << endl
              << "      \"-i {{output file}}\" : output LLVM IR text representation for \"-p\" file" << endl
              << "      \"-o {{output file}}\" : output the compiled executable for \"-p\" file" << endl
-             << "      \"-l{{lib path}}\" : add lib to be compiled with \"-p\" file" << endl
+             << "      \"-l{{lib path}}\" : add lib to be compiled with \"-p\" file, the prebuilt runtime library is used when no lib is given" << endl
+             << "      \"-fuse-ld={{ld|lld|clang++}}\" : linker used to generate the executable (default ld)" << endl
+             << "      \"-parser={{bison|pratt}}\" : parser of the Tiger code (default bison)" << endl
+             << "      \"-emit-ast={{output file}}\" : write the AST of the program to a .tast file (with \"-j\", a directory)" << endl
+             << "      \"-from-ast\" : the input files are .tast files instead of Tiger code" << endl
+             << "      \"-O{{0-3}}\" : optimization level of the generated code (default -O0)" << endl
+             << "      \"-mcpu={{cpu}}\" : cpu to tune the generated code for, \"native\" for the host cpu" << endl
+             << "      \"-mattr={{+feature,-feature}}\" : enable/disable target features" << endl
+             << "      \"-march=native\" : use the host cpu and all of its features" << endl
+             << "      \"-codegen-opt={{0-3}}\" : backend optimization level (default 2)" << endl
+             << "      \"-codegen-partitions={{N}}\" : split the module in N partitions emitted in parallel (default 1)" << endl
+             << "      \"-inline-runtime\" : link the runtime bitcode into the program, so the optimizer can inline it" << endl
+             << "      \"-run\" : run the program in-process through the JIT instead of generating an executable" << endl
+             << "      \"-cache[={{dir}}]\" : reuse the executables of unchanged programs (default dir ~/.cache/tiger-compiler/build)" << endl
+             << "      \"-cache-size={{MB}}\" : maximum size of the cache (default 256)" << endl
+             << "      \"-time-phases\" : print the wall/CPU time, peak RSS and allocated memory of each phase" << endl
+             << "      \"-stats-json={{file}}\" : write the time of each phase as a Chrome trace-event JSON file" << endl
              << "      \"-no-codegen\" : skips the codegen phase, i.e., execute only Syntactic and Semantic analysis" << endl;
         exit(EXIT_FAILURE);
     }
 
-    fname = *(std::find(args.begin(), args.end(), "-p") + 1);
-    yyin = fopen(fname.c_str(), "r");
-    if (!yyin) {
-        cerr << "Cannot open file: " << fname << endl;
-        exit(EXIT_FAILURE);
+    configure(codeGenContext, args);
+
+    bool inlineRuntime = std::find(args.begin(), args.end(), "-inline-runtime") != args.end();
+    bool linkRuntime = codeGenContext.libs.empty()
+                       && !codeGenContext.jit
+                       && std::find(args.begin(), args.end(), "-no-codegen") == args.end();
+    if (linkRuntime || inlineRuntime) {
+        RuntimeLibrary runtime(RuntimeLibrary::defaultDirectory(argv[0]));
+        if (!runtime.ensure()) {
+            cerr << "Runtime library not available, use \"-l{{path to runtime.cpp or runtime.o file}}\"" << endl;
+            exit(EXIT_FAILURE);
+        }
+        if (linkRuntime) {
+            codeGenContext.libs.push_back(runtime.archive());
+        }
+        if (inlineRuntime) {
+            codeGenContext.runtimeBitcode = runtime.bitcode();
+        }
     }
 
+    std::unique_ptr<BuildCache> cache;
+    auto _cache = std::find_if(args.begin(),
+                               args.end(),
+                               [](const std::string &str) {
+                                   return str == "-cache" || str.rfind("-cache=", 0) == 0;
+                               });
+    if (_cache != args.end()) {
+        auto dir = _cache->size() > 6 ? _cache->substr(7) : BuildCache::defaultDirectory();
+
+        std::uint64_t size = 256;
+        auto _cacheSize = findOption(args, "-cache-size=");
+        if (_cacheSize != args.end()) {
+            size = std::strtoull(_cacheSize->substr(12).c_str(), nullptr, 10);
+        }
+
+        cache = std::make_unique<BuildCache>(dir, size << 20, argv[0]);
+        codeGenContext.cache = cache.get();
+    }
+
+    if (_j != args.end()) {
+        if (codeGenContext.jit || std::find(args.begin(), args.end(), "-a") != args.end()) {
+            cerr << "\"-run\" and \"-a\" are not available with \"-j\"" << endl;
+            exit(EXIT_FAILURE);
+        }
+
+        unsigned jobs = std::max(1, atoi(_j->substr(2).c_str()));
+        if (_j->size() == 2) {
+            jobs = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        exit(batch(files, args, jobs, codeGenContext) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    fname = *(std::find(args.begin(), args.end(), "-p") + 1);
+
     auto _i = std::find(args.begin(), args.end(), "-i");
     if (_i != args.end()) {
         codeGenContext.outputFileI = *(++_i);
@@ -112,28 +547,9 @@ int main(int argc, char **argv) {
         codeGenContext.outputFileE = *(++_o);
     }
 
-    auto _l = args.begin();
-    while ((_l = std::find_if(_l,
-                              args.end(),
-                              [](const std::string &str) {
-                                  return str.find("-l") != std::string::npos;
-                              })) != args.end()) {
-        auto l = *(_l++);
-        codeGenContext.libs.push_back(l.substr(2, l.size()));
-    }
-
-    syntacticAnalisys();
-
-    if (std::find(args.begin(), args.end(), "-a") != args.end()) {
-        printABS();
-    }
-
-    semanticAnalisys(codeGenContext);
-
-    if (std::find(args.begin(), args.end(), "-no-codegen") == args.end()) {
-        codegen(codeGenContext);
-        executablegen(codeGenContext);
-    }
+    codeGenContext.timer.file = fname;
+    int exitCode = EXIT_SUCCESS;
+    bool ok = compile(fname, codeGenContext, args, cout, cerr, &exitCode);
 
-    exit(EXIT_SUCCESS);
+    exit(reportTimes(codeGenContext.timer, args) && ok ? exitCode : EXIT_FAILURE);
 }
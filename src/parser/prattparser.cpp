@@ -0,0 +1,945 @@
+#include "parser/prattparser.hpp"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, yyscan_t scanner);
+
+namespace {
+    struct Token {
+        int kind;
+        std::uint32_t offset;
+        YYSTYPE value;
+    };
+
+    /* Binding powers of the operators, from the precedences declared in tiger.y. */
+    enum Power {
+        NONE = 0,
+        LOWEST = 1,
+        OR_POWER = 1,
+        AND_POWER,
+        COMPARE_POWER,
+        SUM_POWER,
+        PRODUCT_POWER,
+        UNARY_POWER
+    };
+
+    int infixPower(int kind) {
+        switch (kind) {
+            case OR:
+                return OR_POWER;
+            case AND:
+                return AND_POWER;
+            case EQ:
+            case NEQ:
+            case LT:
+            case LE:
+            case GT:
+            case GE:
+                return COMPARE_POWER;
+            case PLUS:
+            case MINUS:
+                return SUM_POWER;
+            case TIMES:
+            case DIVIDE:
+                return PRODUCT_POWER;
+            default:
+                return NONE;
+        }
+    }
+
+    BinaryExp::Operator binaryOperator(int kind) {
+        switch (kind) {
+            case PLUS:
+                return BinaryExp::ADD;
+            case MINUS:
+                return BinaryExp::SUB;
+            case TIMES:
+                return BinaryExp::MUL;
+            case DIVIDE:
+                return BinaryExp::DIV;
+            case EQ:
+                return BinaryExp::EQU;
+            case NEQ:
+                return BinaryExp::NEQU;
+            case LT:
+                return BinaryExp::LTH;
+            case LE:
+                return BinaryExp::LEQU;
+            case GT:
+                return BinaryExp::GTH;
+            default:
+                return BinaryExp::GEQU;
+        }
+    }
+
+    /* The constructs a frame of the parser can be in the middle of, see PrattParser::parseExp. */
+    enum class Rule : std::uint8_t {
+        Expression,
+        Negation,
+        Sequence,
+        IdExp,
+        If,
+        While,
+        DoWhile,
+        For,
+        Let,
+        LetBody,
+        VarDec,
+        FunctionDec
+    };
+
+    /*
+     * A construct being parsed. "step" is where its parsing resumes once the
+     * expression it asked for is parsed, the other fields keep what it has
+     * parsed so far.
+     */
+    struct Frame {
+        Rule rule{Rule::Expression};
+        std::uint8_t step{0};
+        /* Expression: the last operator is a comparison. */
+        bool compared{false};
+        /* Expression: the lowest binding power it takes. */
+        int power{LOWEST};
+        /* Expression: the operator whose right operand is parsed. */
+        int kind{0};
+        std::uint32_t offset{0};
+        /* The first of its items on the stacks of the parser. */
+        std::size_t base{0};
+        Exp *exp{nullptr};
+        Exp *high{nullptr};
+        Var *var{nullptr};
+        Identifier *id{nullptr};
+        Identifier *field{nullptr};
+        NameType *type{nullptr};
+        Prototype *proto{nullptr};
+    };
+
+    /* A test and its branch in an "else if" ladder. */
+    struct Branch {
+        std::uint32_t offset;
+        Exp *test;
+        Exp *then;
+    };
+
+    /*
+     * The expressions are parsed from a heap stack of frames rather than
+     * recursively, see parseExp. A step returns false once an error has been
+     * reported, and the parse gives up as soon as it sees it.
+     */
+    class PrattParser {
+        ParserState &state_;
+        std::vector<Token> tokens_;
+        size_t pos_{0};
+        bool failed_{false};
+        /* The frame a step asks for, pushed once the step returns. */
+        Frame child_;
+        /* The items of the lists being parsed, each frame owns them from its "base" on. */
+        std::vector<Exp *> exps_;
+        std::vector<Dec *> decs_;
+        std::vector<FieldExp *> fieldExps_;
+        std::vector<Branch> branches_;
+        std::vector<std::uint32_t> negations_;
+
+        Token const &peek() const {
+            return tokens_[pos_];
+        }
+
+        bool at(int kind) const {
+            return tokens_[pos_].kind == kind;
+        }
+
+        /* The last token is the end of the input, it is never consumed. */
+        Token const &next() {
+            return pos_ + 1 < tokens_.size() ? tokens_[pos_++] : tokens_[pos_];
+        }
+
+        bool accept(int kind) {
+            if (!at(kind)) {
+                return false;
+            }
+            next();
+            return true;
+        }
+
+        bool expect(int kind) {
+            return accept(kind) || error();
+        }
+
+        bool error() {
+            if (!failed_) {
+                *state_.diagnostics << "syntactic error" << std::endl;
+                failed_ = true;
+            }
+            return false;
+        }
+
+        /* Asks for a "rule" construct at the next token, returns false like a step that is not done. */
+        bool push(Rule rule, int power = LOWEST) {
+            child_ = Frame{};
+            child_.rule = rule;
+            child_.power = power;
+            child_.offset = peek().offset;
+            return false;
+        }
+
+        /* The items from "base" on, removed, in the reverse order the AST constructors take. */
+        template<typename T>
+        std::vector<unique_ptr<T>> take(std::vector<T *> &items, std::size_t base) {
+            std::vector<unique_ptr<T>> taken;
+            taken.reserve(items.size() - base);
+            for (auto i = items.size(); i-- > base;) {
+                taken.emplace_back(items[i]);
+            }
+            items.resize(base);
+            return taken;
+        }
+
+        template<typename T, typename... Args>
+        T *make(Args &&... args) {
+            return state_.arena->make<T>(std::forward<Args>(args)...);
+        }
+
+        template<typename T, typename... Args>
+        unique_ptr<T> makeUnique(Args &&... args) {
+            return state_.arena->makeUnique<T>(std::forward<Args>(args)...);
+        }
+
+        Identifier *parseId();
+
+        Exp *parseExp();
+
+        /*
+         * Resumes "frame" with "value", the expression it asked for (nullptr
+         * the first time). Returns true once the construct is parsed, with its
+         * expression in "value", or false with the frame it asks for in "child_".
+         */
+        bool step(Frame &frame, Exp *&value);
+
+        bool expression(Frame &frame, Exp *&value);
+
+        bool negation(Frame &frame, Exp *&value);
+
+        bool sequence(Frame &frame, Exp *&value);
+
+        bool idExp(Frame &frame, Exp *&value);
+
+        bool field(Frame &frame);
+
+        bool variable(Frame &frame, Exp *&value);
+
+        bool ifExp(Frame &frame, Exp *&value);
+
+        bool ladder(Frame &frame, Exp *&value);
+
+        bool whileExp(Frame &frame, Exp *&value);
+
+        bool doWhileExp(Frame &frame, Exp *&value);
+
+        bool forExp(Frame &frame, Exp *&value);
+
+        bool letExp(Frame &frame, Exp *&value);
+
+        bool varDec(Frame &frame, Exp *&value);
+
+        bool functionDec(Frame &frame, Exp *&value);
+
+        bool list(Exp *value, int separator, int close);
+
+        Dec *parseTypeDec();
+
+        Type *parseTy();
+
+        bool parseTyfields(std::vector<unique_ptr<Field>> &fields);
+
+    public:
+        PrattParser(ParserState &state, std::vector<Token> tokens) :
+                state_(state), tokens_(std::move(tokens)) {}
+
+        Root *parseRoot();
+    };
+
+    Identifier *PrattParser::parseId() {
+        if (!at(ID)) {
+            error();
+            return nullptr;
+        }
+
+        auto &token = next();
+        return make<Identifier>(Location(token.offset), token.value.sym);
+    }
+
+    /*
+     * Parses an expression with a heap stack of the constructs it is in the
+     * middle of, so the depth of a program is not bounded by the stack. The
+     * frame on top either finishes its construct, whose expression resumes
+     * the frame below, or asks for an expression, whose frame is pushed.
+     */
+    Exp *PrattParser::parseExp() {
+        std::vector<Frame> frames;
+        push(Rule::Expression);
+        frames.push_back(child_);
+
+        Exp *value = nullptr;
+        for (;;) {
+            auto done = step(frames.back(), value);
+            if (failed_) {
+                return nullptr;
+            }
+
+            if (!done) {
+                frames.push_back(child_);
+                value = nullptr;
+                continue;
+            }
+
+            frames.pop_back();
+            if (frames.empty()) {
+                return value;
+            }
+        }
+    }
+
+    bool PrattParser::step(Frame &frame, Exp *&value) {
+        switch (frame.rule) {
+            case Rule::Expression:
+                return expression(frame, value);
+            case Rule::Negation:
+                return negation(frame, value);
+            case Rule::Sequence:
+                return sequence(frame, value);
+            case Rule::IdExp:
+                return idExp(frame, value);
+            case Rule::If:
+                return ifExp(frame, value);
+            case Rule::While:
+                return whileExp(frame, value);
+            case Rule::DoWhile:
+                return doWhileExp(frame, value);
+            case Rule::For:
+                return forExp(frame, value);
+            case Rule::Let:
+            case Rule::LetBody:
+                return letExp(frame, value);
+            case Rule::VarDec:
+                return varDec(frame, value);
+            case Rule::FunctionDec:
+                return functionDec(frame, value);
+        }
+
+        return error();
+    }
+
+    /*
+     * An operand and the operators that bind at least "frame.power": the
+     * operand is a literal or a construct, the right operand of each operator
+     * is an expression that binds tighter.
+     */
+    bool PrattParser::expression(Frame &frame, Exp *&value) {
+        Location loc(frame.offset);
+
+        switch (frame.step) {
+            case 0: {
+                auto &token = peek();
+                frame.step = 1;
+                switch (token.kind) {
+                    case NIL:
+                        next();
+                        frame.exp = make<NilExp>(loc);
+                        break;
+                    case INT:
+                        next();
+                        frame.exp = make<IntExp>(loc, token.value.ival);
+                        break;
+                    case STRING:
+                        next();
+                        frame.exp = make<StringExp>(loc, *token.value.sval);
+                        break;
+                    case BREAK:
+                        next();
+                        frame.exp = make<BreakExp>(loc);
+                        break;
+                    case ID:
+                        return push(Rule::IdExp);
+                    case MINUS:
+                        return push(Rule::Negation);
+                    case LPAREN:
+                        return push(Rule::Sequence);
+                    case IF:
+                        return push(Rule::If);
+                    case WHILE:
+                        return push(Rule::While);
+                    case DO:
+                        return push(Rule::DoWhile);
+                    case FOR:
+                        return push(Rule::For);
+                    case LET:
+                        return push(Rule::Let);
+                    default:
+                        return error();
+                }
+                break;
+            }
+            case 1:
+                frame.exp = value;
+                break;
+            default:
+                if (frame.kind == AND) {
+                    frame.exp = make<IfExp>(loc,
+                                            unique_ptr<Exp>(frame.exp),
+                                            unique_ptr<Exp>(value),
+                                            makeUnique<IntExp>(loc, 0));
+                } else if (frame.kind == OR) {
+                    frame.exp = make<IfExp>(loc,
+                                            unique_ptr<Exp>(frame.exp),
+                                            makeUnique<IntExp>(loc, 1),
+                                            unique_ptr<Exp>(value));
+                } else {
+                    frame.exp = make<BinaryExp>(loc,
+                                                binaryOperator(frame.kind),
+                                                unique_ptr<Exp>(frame.exp),
+                                                unique_ptr<Exp>(value));
+                }
+        }
+
+        auto kind = peek().kind;
+        auto power = infixPower(kind);
+        if (power == NONE || power < frame.power) {
+            value = frame.exp;
+            return true;
+        }
+
+        /* The comparisons are non-associative. */
+        if (power == COMPARE_POWER && frame.compared) {
+            return error();
+        }
+        frame.compared = power == COMPARE_POWER;
+
+        next();
+        frame.kind = kind;
+        frame.step = 2;
+        return push(Rule::Expression, power + 1);
+    }
+
+    /* "- - - e" is read in a loop, the negations are applied from the innermost one. */
+    bool PrattParser::negation(Frame &frame, Exp *&value) {
+        if (frame.step == 0) {
+            frame.base = negations_.size();
+            while (at(MINUS)) {
+                negations_.push_back(peek().offset);
+                next();
+            }
+
+            frame.step = 1;
+            return push(Rule::Expression, UNARY_POWER);
+        }
+
+        for (auto i = negations_.size(); i-- > frame.base;) {
+            Location loc(negations_[i]);
+            value = make<BinaryExp>(loc,
+                                    BinaryExp::SUB,
+                                    makeUnique<IntExp>(loc, 0),
+                                    unique_ptr<Exp>(value));
+        }
+        negations_.resize(frame.base);
+
+        return true;
+    }
+
+    bool PrattParser::sequence(Frame &frame, Exp *&value) {
+        if (frame.step == 0) {
+            next();
+            frame.base = exps_.size();
+            frame.step = 1;
+        }
+
+        if (!list(value, SEMICOLON, RPAREN)) {
+            return false;
+        }
+
+        value = make<SequenceExp>(Location(frame.offset), take(exps_, frame.base));
+        return true;
+    }
+
+    /*
+     * One step of "exp separator ... exp close", "value" is the expression
+     * just parsed (nullptr before the first one), the expressions are kept on
+     * "exps_". Returns true once "close" is read. The sequences (separated by
+     * ";") may end with a separator, the arguments may not.
+     */
+    bool PrattParser::list(Exp *value, int separator, int close) {
+        if (value) {
+            exps_.push_back(value);
+            if (!accept(separator)) {
+                return expect(close);
+            }
+            if (separator == COMMA && at(close)) {
+                return error();
+            }
+        }
+
+        if (accept(close)) {
+            return true;
+        }
+
+        return push(Rule::Expression);
+    }
+
+    /* The expressions that start with an identifier: creations, calls, assignments and variables. */
+    bool PrattParser::idExp(Frame &frame, Exp *&value) {
+        Location loc(frame.offset);
+
+        switch (frame.step) {
+            case 0:
+                frame.id = parseId();
+                if (accept(LBRACK)) {
+                    frame.step = 1;
+                    return push(Rule::Expression);
+                } else if (accept(LBRACE)) {
+                    frame.base = fieldExps_.size();
+                    frame.step = 3;
+                    if (at(RBRACE)) {
+                        break;
+                    }
+                    return field(frame);
+                } else if (accept(LPAREN)) {
+                    frame.base = exps_.size();
+                    frame.step = 4;
+                    return idExp(frame, value);
+                }
+                frame.var = make<SimpleVar>(loc, *frame.id);
+                frame.step = 5;
+                return variable(frame, value);
+            case 1:
+                if (!expect(RBRACK)) {
+                    return false;
+                }
+                if (accept(OF)) {
+                    frame.exp = value;
+                    frame.step = 2;
+                    return push(Rule::Expression);
+                }
+                frame.var = make<SubscriptVar>(loc, makeUnique<SimpleVar>(loc, *frame.id), unique_ptr<Exp>(value));
+                frame.step = 5;
+                return variable(frame, value);
+            case 2:
+                value = make<ArrayExp>(loc,
+                                       makeUnique<NameType>(loc, *frame.id),
+                                       unique_ptr<Exp>(frame.exp),
+                                       unique_ptr<Exp>(value));
+                return true;
+            case 3:
+                fieldExps_.push_back(make<FieldExp>(frame.field->getLoc(), *frame.field, unique_ptr<Exp>(value)));
+                if (accept(COMMA)) {
+                    return field(frame);
+                }
+                break;
+            case 4:
+                if (!list(value, COMMA, RPAREN)) {
+                    return false;
+                }
+                value = make<CallExp>(loc, *frame.id, take(exps_, frame.base));
+                return true;
+            default:
+                return variable(frame, value);
+        }
+
+        if (!expect(RBRACE)) {
+            return false;
+        }
+        value = make<RecordExp>(loc, makeUnique<NameType>(loc, *frame.id), take(fieldExps_, frame.base));
+        return true;
+    }
+
+    /* "id = exp" in a record creation, the expression is parsed by its own frame. */
+    bool PrattParser::field(Frame &frame) {
+        frame.field = parseId();
+        if (!frame.field || !expect(EQ)) {
+            return false;
+        }
+        return push(Rule::Expression);
+    }
+
+    /* The field and subscript chain of a variable, and the assignment to it. */
+    bool PrattParser::variable(Frame &frame, Exp *&value) {
+        Location loc(frame.offset);
+
+        if (frame.step == 6) {
+            if (!expect(RBRACK)) {
+                return false;
+            }
+            frame.var = make<SubscriptVar>(loc, unique_ptr<Var>(frame.var), unique_ptr<Exp>(value));
+        } else if (frame.step == 7) {
+            value = make<AssignExp>(loc, unique_ptr<Var>(frame.var), unique_ptr<Exp>(value));
+            return true;
+        }
+
+        for (;;) {
+            if (accept(DOT)) {
+                auto field = parseId();
+                if (!field) {
+                    return false;
+                }
+                frame.var = make<FieldVar>(loc, unique_ptr<Var>(frame.var), *field);
+            } else if (accept(LBRACK)) {
+                frame.step = 6;
+                return push(Rule::Expression);
+            } else {
+                break;
+            }
+        }
+
+        if (accept(ASSIGN)) {
+            frame.step = 7;
+            return push(Rule::Expression);
+        }
+
+        value = make<VarExp>(loc, unique_ptr<Var>(frame.var));
+        return true;
+    }
+
+    /*
+     * An "else if" ladder is kept in one frame, its branches on "branches_".
+     * An "if" that is the else branch can not be followed by an operator, the
+     * branches of the "if" take them all.
+     */
+    bool PrattParser::ifExp(Frame &frame, Exp *&value) {
+        switch (frame.step) {
+            case 0:
+                frame.base = branches_.size();
+                break;
+            case 1:
+                branches_.back().test = value;
+                if (!expect(THEN)) {
+                    return false;
+                }
+                frame.step = 2;
+                return push(Rule::Expression);
+            case 2:
+                branches_.back().then = value;
+                value = nullptr;
+                if (!accept(ELSE)) {
+                    return ladder(frame, value);
+                }
+                if (!at(IF)) {
+                    frame.step = 3;
+                    return push(Rule::Expression);
+                }
+                break;
+            default:
+                return ladder(frame, value);
+        }
+
+        branches_.push_back({next().offset, nullptr, nullptr});
+        frame.step = 1;
+        return push(Rule::Expression);
+    }
+
+    /* Builds the "if" of a ladder from the last branch, "value" is the last else branch. */
+    bool PrattParser::ladder(Frame &frame, Exp *&value) {
+        for (auto i = branches_.size(); i-- > frame.base;) {
+            auto &branch = branches_[i];
+            value = make<IfExp>(Location(branch.offset),
+                                unique_ptr<Exp>(branch.test),
+                                unique_ptr<Exp>(branch.then),
+                                unique_ptr<Exp>(value));
+        }
+        branches_.resize(frame.base);
+
+        return true;
+    }
+
+    bool PrattParser::whileExp(Frame &frame, Exp *&value) {
+        switch (frame.step) {
+            case 0:
+                next();
+                frame.step = 1;
+                return push(Rule::Expression);
+            case 1:
+                frame.exp = value;
+                if (!expect(DO)) {
+                    return false;
+                }
+                frame.step = 2;
+                return push(Rule::Expression);
+            default:
+                value = make<WhileExp>(Location(frame.offset), unique_ptr<Exp>(frame.exp), unique_ptr<Exp>(value));
+                return true;
+        }
+    }
+
+    bool PrattParser::doWhileExp(Frame &frame, Exp *&value) {
+        switch (frame.step) {
+            case 0:
+                next();
+                frame.step = 1;
+                return push(Rule::Expression);
+            case 1:
+                frame.exp = value;
+                if (!expect(WHILE)) {
+                    return false;
+                }
+                frame.step = 2;
+                return push(Rule::Expression);
+            default:
+                value = make<DoWhileExp>(Location(frame.offset), unique_ptr<Exp>(frame.exp), unique_ptr<Exp>(value));
+                return true;
+        }
+    }
+
+    bool PrattParser::forExp(Frame &frame, Exp *&value) {
+        switch (frame.step) {
+            case 0:
+                next();
+                frame.id = parseId();
+                if (!frame.id || !expect(ASSIGN)) {
+                    return false;
+                }
+                frame.step = 1;
+                return push(Rule::Expression);
+            case 1:
+                frame.exp = value;
+                if (!expect(TO)) {
+                    return false;
+                }
+                frame.step = 2;
+                return push(Rule::Expression);
+            case 2:
+                frame.high = value;
+                if (!expect(DO)) {
+                    return false;
+                }
+                frame.step = 3;
+                return push(Rule::Expression);
+            default:
+                value = make<ForExp>(Location(frame.offset),
+                                     *frame.id,
+                                     unique_ptr<Exp>(frame.exp),
+                                     unique_ptr<Exp>(frame.high),
+                                     unique_ptr<Exp>(value));
+                return true;
+        }
+    }
+
+    /*
+     * The declarations are kept on "decs_", the ones with an expression are
+     * parsed by their own frames. The body is parsed by a "LetBody" frame,
+     * that gives the sequence of its expressions.
+     */
+    bool PrattParser::letExp(Frame &frame, Exp *&value) {
+        Location loc(frame.offset);
+
+        if (frame.rule == Rule::LetBody) {
+            if (frame.step == 0) {
+                frame.base = exps_.size();
+                frame.step = 1;
+            }
+            if (!list(value, SEMICOLON, END)) {
+                return false;
+            }
+            value = make<SequenceExp>(loc, take(exps_, frame.base));
+            return true;
+        }
+
+        switch (frame.step) {
+            case 0:
+                next();
+                frame.base = decs_.size();
+                frame.step = 1;
+                break;
+            case 2:
+                value = make<LetExp>(loc, take(decs_, frame.base), unique_ptr<Exp>(value));
+                return true;
+        }
+
+        while (!at(IN)) {
+            switch (peek().kind) {
+                case TYPE: {
+                    auto dec = parseTypeDec();
+                    if (!dec) {
+                        return false;
+                    }
+                    decs_.push_back(dec);
+                    break;
+                }
+                case VAR:
+                    return push(Rule::VarDec);
+                case FUNCTION:
+                    return push(Rule::FunctionDec);
+                default:
+                    return error();
+            }
+        }
+
+        next();
+        frame.step = 2;
+        push(Rule::LetBody);
+        child_.offset = frame.offset;
+        return false;
+    }
+
+    /* Parses the declaration onto "decs_", it gives no expression. */
+    bool PrattParser::varDec(Frame &frame, Exp *&value) {
+        Location loc(frame.offset);
+
+        if (frame.step == 0) {
+            next();
+            frame.id = parseId();
+            if (!frame.id) {
+                return false;
+            }
+            if (accept(COLON)) {
+                auto typeId = parseId();
+                if (!typeId) {
+                    return false;
+                }
+                frame.type = make<NameType>(typeId->getLoc(), *typeId);
+            }
+            if (!expect(ASSIGN)) {
+                return false;
+            }
+            frame.step = 1;
+            return push(Rule::Expression);
+        }
+
+        decs_.push_back(make<VarDec>(loc, *frame.id, unique_ptr<NameType>(frame.type), unique_ptr<Exp>(value)));
+        value = nullptr;
+        return true;
+    }
+
+    /* Parses the declaration onto "decs_", it gives no expression. */
+    bool PrattParser::functionDec(Frame &frame, Exp *&value) {
+        Location loc(frame.offset);
+
+        if (frame.step == 0) {
+            next();
+            auto id = parseId();
+            if (!id || !expect(LPAREN)) {
+                return false;
+            }
+            std::vector<unique_ptr<Field>> params;
+            if (!parseTyfields(params) || !expect(RPAREN)) {
+                return false;
+            }
+            Identifier result(loc, Symbol());
+            if (accept(COLON)) {
+                auto resultId = parseId();
+                if (!resultId) {
+                    return false;
+                }
+                result = *resultId;
+            }
+            if (!expect(EQ)) {
+                return false;
+            }
+            frame.id = id;
+            frame.proto = make<Prototype>(loc, *id, std::move(params), result);
+            frame.step = 1;
+            return push(Rule::Expression);
+        }
+
+        decs_.push_back(make<FunctionDec>(loc, *frame.id, unique_ptr<Prototype>(frame.proto), unique_ptr<Exp>(value)));
+        value = nullptr;
+        return true;
+    }
+
+    Dec *PrattParser::parseTypeDec() {
+        Location loc(next().offset);
+        auto id = parseId();
+        if (!id || !expect(EQ)) {
+            return nullptr;
+        }
+        auto ty = parseTy();
+        if (!ty) {
+            return nullptr;
+        }
+        return make<TypeDec>(loc, *id, unique_ptr<Type>(ty));
+    }
+
+    Type *PrattParser::parseTy() {
+        auto &token = peek();
+        Location loc(token.offset);
+
+        if (accept(LBRACE)) {
+            std::vector<unique_ptr<Field>> fields;
+            if (!parseTyfields(fields) || !expect(RBRACE)) {
+                return nullptr;
+            }
+            return make<RecordType>(loc, std::move(fields));
+        }
+
+        if (accept(ARRAY)) {
+            if (!expect(OF)) {
+                return nullptr;
+            }
+            auto id = parseId();
+            if (!id) {
+                return nullptr;
+            }
+            return make<ArrayType>(loc, *id);
+        }
+
+        auto id = parseId();
+        if (!id) {
+            return nullptr;
+        }
+        return make<NameType>(loc, *id);
+    }
+
+    /* Parses "id : id, ..." into "fields", in reverse order. */
+    bool PrattParser::parseTyfields(std::vector<unique_ptr<Field>> &fields) {
+        if (at(ID)) {
+            do {
+                auto name = parseId();
+                if (!name || !expect(COLON)) {
+                    return false;
+                }
+                auto type = parseId();
+                if (!type) {
+                    return false;
+                }
+                fields.push_back(makeUnique<Field>(name->getLoc(), *name, *type));
+            } while (accept(COMMA));
+        }
+
+        std::reverse(fields.begin(), fields.end());
+        return true;
+    }
+
+    Root *PrattParser::parseRoot() {
+        Location loc(peek().offset);
+        auto exp = parseExp();
+        if (!exp) {
+            return nullptr;
+        }
+
+        if (!at(0)) {
+            error();
+            return nullptr;
+        }
+
+        return new Root(loc, unique_ptr<Exp>(exp));
+    }
+}
+
+int prattParse(yyscan_t scanner, ParserState &state) {
+    std::vector<Token> tokens;
+    tokens.reserve(state.lineTable->getSource().size() / 4 + 1);
+
+    Token token{};
+    YYLTYPE location{state.offset};
+    do {
+        token.kind = yylex(&token.value, &location, scanner);
+        token.offset = location.offset;
+        tokens.push_back(token);
+    } while (token.kind != 0);
+
+    PrattParser parser(state, std::move(tokens));
+    auto root = parser.parseRoot();
+    if (!root) {
+        return 1;
+    }
+
+    state.root = std::unique_ptr<Root>(root);
+    return 0;
+}
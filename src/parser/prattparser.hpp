@@ -0,0 +1,16 @@
+#ifndef PRATTPARSER_HPP
+#define PRATTPARSER_HPP
+
+#include "tiger.parser.hpp"
+
+/*
+ * Hand-written parser of the grammar of tiger.y: precedence climbing (Pratt)
+ * for the operators, driven by a heap stack of the constructs being parsed
+ * instead of recursion, so programs of any depth are parsed. The tokens of the whole program are read from "scanner" into a
+ * buffer first, then the AST is built in "state.arena" with the same nodes and
+ * locations as the bison parser.
+ * Returns 0 and sets "state.root" on success, like yyparse.
+ */
+int prattParse(yyscan_t scanner, ParserState &state);
+
+#endif  // PRATTPARSER_HPP
@@ -1,30 +1,124 @@
 %{
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include "ast/ast.hpp"
 #include <string>
 #include <llvm/ADT/STLExtras.h>
 
 using namespace AST;
-
-std::unique_ptr<Root> root;
-
-int yylex(void); /* function prototype */
-
-void yyerror(char *s) {
-    std::cerr << "syntactic error" << std::endl;
-}
 %}
 
 %code requires{
+#include <cstdint>
+#include <cstdio>
+#include <string>
 #include "ast/ast.hpp"
 
 using namespace AST;
+
+/* Location of a token or of a rule: the byte offset of its first character. */
+struct YYLTYPE {
+    std::uint32_t offset;
+};
+#define YYLTYPE_IS_DECLARED 1
+#define YYLLOC_DEFAULT(Current, Rhs, N) \
+    ((Current).offset = (N) ? YYRHSLOC(Rhs, 1).offset : YYRHSLOC(Rhs, 0).offset)
+
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+
+/**
+ * Per-compilation state of the scanner and the parser. Nothing is shared
+ * between two parses, so several programs may be parsed at the same time.
+ */
+struct ParserState {
+    LineTable const *lineTable{nullptr};
+    std::uint32_t offset{0};
+    int commentDepth{0};
+    char const *stringStart{nullptr};
+    bool stringEscaped{false};
+    std::string strbuf;
+    std::unique_ptr<Arena> arena{std::make_unique<Arena>()};
+    std::unique_ptr<Root> root;
+    std::vector<std::unique_ptr<char[]>> stacks;
+    /* Where the lexical and syntactic errors are written. */
+    std::ostream *diagnostics{&std::cerr};
+
+    unsigned lexline() const {
+        return lineTable->getLine(offset);
+    }
+};
+
+/* Parser used by parse(): the bison one or the hand-written one of prattparser.hpp. */
+enum class ParserKind {
+    Bison,
+    Pratt
+};
+
+/**
+ * Parses the Tiger program read from "in", its errors are written to "diagnostics".
+ * Returns the AST root or nullptr when the program has a syntactic error.
+ */
+std::unique_ptr<Root> parse(FILE *in, ParserKind kind = ParserKind::Bison,
+                            std::ostream &diagnostics = std::cerr);
+}
+
+%code {
+int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, yyscan_t scanner);
+
+/*
+ * Right-recursive rules (sequences, declarations, "else if" ladders) keep one
+ * stack entry per element until the end of the list, so generated programs
+ * need far more than the default 10000 entries.
+ */
+#define YYMAXDEPTH (1 << 26)
+
+/*
+ * Bison only relocates its stacks by itself in C++ when YYLTYPE is its own
+ * four-int structure, so the stacks are grown here: each growth doubles them
+ * into a block that is released with the parser state.
+ */
+#define yyoverflow(message, ss, ssSize, vs, vsSize, ls, lsSize, stackSize) \
+    growStacks(state, ss, ssSize, vs, vsSize, ls, lsSize, stackSize, YYMAXDEPTH)
+
+template<typename T>
+static void growStack(ParserState &state, T **stack, size_t size, size_t newSize) {
+    auto block = std::make_unique<char[]>(newSize * sizeof(T));
+    std::memcpy(block.get(), *stack, size);
+    *stack = reinterpret_cast<T *>(block.get());
+    state.stacks.push_back(std::move(block));
+}
+
+template<typename S, typename V, typename L, typename N>
+static void growStacks(ParserState &state, S **ss, size_t ssSize, V **vs, size_t vsSize,
+                       L **ls, size_t lsSize, N *stackSize, size_t maxDepth) {
+    if (static_cast<size_t>(*stackSize) >= maxDepth) {
+        return;
+    }
+
+    *stackSize = std::min<N>(*stackSize * 2, maxDepth);
+    growStack(state, ss, ssSize, *stackSize);
+    growStack(state, vs, vsSize, *stackSize);
+    growStack(state, ls, lsSize, *stackSize);
+}
+
+void yyerror(YYLTYPE *, yyscan_t, ParserState &state, const char *) {
+    *state.diagnostics << "syntactic error" << std::endl;
+}
 }
 
+%define api.pure full
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {ParserState &state}
+
 %union {
 	int pos;
 	int ival;
-	std::string *sval;
+	llvm::StringRef *sval;
+    Symbol sym;
     Identifier *id;
     Root *root;
     Exp *exp;
@@ -34,15 +128,19 @@ using namespace AST;
     Field *field;
     TypeDec *typeDec;
     FunctionDec *functionDec;
-    std::vector<std::unique_ptr<Exp>> *exps;
-    std::vector<std::unique_ptr<Dec>> *decList;
-    std::vector<std::unique_ptr<Field>> *fieldList;
-    std::vector<std::unique_ptr<FieldExp>> *fieldExpList;
+    std::vector<AST::unique_ptr<Exp>> *exps;
+    std::vector<AST::unique_ptr<Dec>> *decList;
+    std::vector<AST::unique_ptr<Field>> *fieldList;
+    std::vector<AST::unique_ptr<FieldExp>> *fieldExpList;
+
+    /* Symbol initializes its id, the union must say which member it starts with: none. */
+    YYSTYPE() {}
 }
 
 %locations
 
-%token <sval> ID STRING
+%token <sym> ID
+%token <sval> STRING
 %token <ival> INT
 
 %token
@@ -77,136 +175,128 @@ using namespace AST;
 
 program:
     root {
-        root = std::unique_ptr<Root>($1);
+        state.root = std::unique_ptr<Root>($1);
     };
 
 root:
     exp {
-        $$ = new Root(Location(@1.first_line, @1.first_column), std::unique_ptr<Exp>($1));
+        $$ = new Root(Location(@1.offset), unique_ptr<Exp>($1));
     };
 
 exp:
     /*Literals.*/
     NIL {
-        $$ = new NilExp(Location(@1.first_line, @1.first_column));
+        $$ = state.arena->make<NilExp>(Location(@1.offset));
     }
     | INT {
-        $$ = new IntExp(Location(@1.first_line, @1.first_column), $1);
+        $$ = state.arena->make<IntExp>(Location(@1.offset), $1);
     }
     | STRING {
-        $$ = new StringExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<StringExp>(Location(@1.offset),
                 *$1);
-        
-        delete $1;
     }
     /*Array and record creations.*/
     | id LBRACK exp RBRACK OF exp {
-        $$ = new ArrayExp(Location(@1.first_line, @1.first_column),
-                std::make_unique<NameType>(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<ArrayExp>(Location(@1.offset),
+                state.arena->makeUnique<NameType>(Location(@1.offset),
                     *$1),
-                std::unique_ptr<Exp>($3),
-                std::unique_ptr<Exp>($6));
-
-        delete $1;
+                unique_ptr<Exp>($3),
+                unique_ptr<Exp>($6));
     }
     | id LBRACE atribuitions RBRACE {
-        $$ = new RecordExp(Location(@1.first_line, @1.first_column),
-                std::make_unique<NameType>(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<RecordExp>(Location(@1.offset),
+                state.arena->makeUnique<NameType>(Location(@1.offset),
                     *$1),
                 std::move(*$3));
-
-        delete $1;
     }
     /*Variables, field, elements of an array.*/
     | lvalue {
-        $$ = new VarExp(Location(@1.first_line, @1.first_column),
-                std::unique_ptr<Var>($1));
+        $$ = state.arena->make<VarExp>(Location(@1.offset),
+                unique_ptr<Var>($1));
     }
     /*Function call.*/
     | id LPAREN arguments RPAREN {
-        $$ = new CallExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<CallExp>(Location(@1.offset),
                 *$1, std::move(*$3));
-        
-        delete $1;
     }
     /*Operations.*/
     | MINUS exp %prec UMINUS {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                     BinaryExp::SUB,
-                    std::unique_ptr<Exp>(new IntExp(Location(@1.first_line, @1.first_column), 0)),
-                    std::unique_ptr<Exp>($2));
+                    unique_ptr<Exp>(state.arena->make<IntExp>(Location(@1.offset), 0)),
+                    unique_ptr<Exp>($2));
     }
     | exp AND exp {
-        $$ = new IfExp(Location(@1.first_line, @1.first_column),
-                std::unique_ptr<Exp>($1),
-                std::unique_ptr<Exp>($3),
-                std::unique_ptr<Exp>(new IntExp(Location(@1.first_line, @1.first_column), 0)));
+        $$ = state.arena->make<IfExp>(Location(@1.offset),
+                unique_ptr<Exp>($1),
+                unique_ptr<Exp>($3),
+                unique_ptr<Exp>(state.arena->make<IntExp>(Location(@1.offset), 0)));
     }
     | exp OR exp {
-        $$ = new IfExp(Location(@1.first_line, @1.first_column),
-                std::unique_ptr<Exp>($1),
-                std::unique_ptr<Exp>(new IntExp(Location(@1.first_line, @1.first_column), 1)),
-                std::unique_ptr<Exp>($3));    
+        $$ = state.arena->make<IfExp>(Location(@1.offset),
+                unique_ptr<Exp>($1),
+                unique_ptr<Exp>(state.arena->make<IntExp>(Location(@1.offset), 1)),
+                unique_ptr<Exp>($3));    
     }
     | exp PLUS exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::ADD, 
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | exp MINUS exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::SUB, 
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | exp TIMES exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::MUL, 
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | exp DIVIDE exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::DIV, 
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | exp EQ exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::EQU, 
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | exp NEQ exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::NEQU, 
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | exp GT exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::GTH, 
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | exp LT exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::LTH, 
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | exp GE exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::GEQU,
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | exp LE exp {
-        $$ = new BinaryExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<BinaryExp>(Location(@1.offset),
                 BinaryExp::LEQU,
-                std::unique_ptr<Exp>($1), std::unique_ptr<Exp>($3));
+                unique_ptr<Exp>($1), unique_ptr<Exp>($3));
     }
     | LPAREN exps RPAREN {
-        $$ = new SequenceExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<SequenceExp>(Location(@1.offset),
                 std::move(*$2));
     }
     /*Assignment.*/
     | lvalue ASSIGN exp {
-        $$ = new AssignExp(Location(@1.first_line, @1.first_column),
-                std::unique_ptr<Var>($1),
-                std::unique_ptr<Exp>($3));
+        $$ = state.arena->make<AssignExp>(Location(@1.offset),
+                unique_ptr<Var>($1),
+                unique_ptr<Exp>($3));
     }
     /*Control structures.*/
     | iff {
@@ -221,86 +311,78 @@ exp:
 
 iff:
     IF exp THEN exp {
-        $$ = new IfExp(Location(@1.first_line, @1.first_column), std::unique_ptr<Exp>($2), std::unique_ptr<Exp>($4), nullptr);
+        $$ = state.arena->make<IfExp>(Location(@1.offset), unique_ptr<Exp>($2), unique_ptr<Exp>($4), nullptr);
     }
     | IF exp THEN exp ELSE exp {
-        $$ = new IfExp(Location(@1.first_line, @1.first_column), std::unique_ptr<Exp>($2), std::unique_ptr<Exp>($4), std::unique_ptr<Exp>($6));
+        $$ = state.arena->make<IfExp>(Location(@1.offset), unique_ptr<Exp>($2), unique_ptr<Exp>($4), unique_ptr<Exp>($6));
     };
 
 loop:
     WHILE exp DO exp {
-        $$ = new WhileExp(Location(@1.first_line, @1.first_column), std::unique_ptr<Exp>($2), std::unique_ptr<Exp>($4));
+        $$ = state.arena->make<WhileExp>(Location(@1.offset), unique_ptr<Exp>($2), unique_ptr<Exp>($4));
     }
     | DO exp WHILE exp {
-        $$ = new DoWhileExp(Location(@1.first_line, @1.first_column), std::unique_ptr<Exp>($2), std::unique_ptr<Exp>($4));
+        $$ = state.arena->make<DoWhileExp>(Location(@1.offset), unique_ptr<Exp>($2), unique_ptr<Exp>($4));
     }
     | FOR id ASSIGN exp TO exp DO exp {
-        $$ = new ForExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<ForExp>(Location(@1.offset),
                         *$2,
-                        std::unique_ptr<Exp>($4),
-                        std::unique_ptr<Exp>($6), 
-                        std::unique_ptr<Exp>($8));
-        
-        delete $2;
+                        unique_ptr<Exp>($4),
+                        unique_ptr<Exp>($6), 
+                        unique_ptr<Exp>($8));
     }
     | BREAK {
-        $$ = new BreakExp(Location(@1.first_line, @1.first_column));
+        $$ = state.arena->make<BreakExp>(Location(@1.offset));
     };
 
 let:
     LET decs IN exps END {
-        $$ = new LetExp(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<LetExp>(Location(@1.offset),
                 std::move(*$2),
-                std::make_unique<SequenceExp>(Location(@1.first_line, @1.first_column),
+                state.arena->makeUnique<SequenceExp>(Location(@1.offset),
                     std::move(*$4)));
     };
 
 lvalue:
     id {
-        $$ = new SimpleVar(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<SimpleVar>(Location(@1.offset),
                 *$1);
-        
-        delete $1;
     }
     | id LBRACK exp RBRACK {
-        $$ = new SubscriptVar(Location(@1.first_line, @1.first_column),
-                std::make_unique<SimpleVar>(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<SubscriptVar>(Location(@1.offset),
+                state.arena->makeUnique<SimpleVar>(Location(@1.offset),
                    *$1),
-                std::unique_ptr<Exp>($3));
-            
-        delete $1;
+                unique_ptr<Exp>($3));
     }
     | lvalue DOT id {
-        $$ = new FieldVar(Location(@1.first_line, @1.first_column),
-                std::unique_ptr<Var>($1),
+        $$ = state.arena->make<FieldVar>(Location(@1.offset),
+                unique_ptr<Var>($1),
                 *$3);
-
-        delete $3;
     }
     | lvalue LBRACK exp RBRACK {
-        $$ = new SubscriptVar(Location(@1.first_line, @1.first_column),
-                std::unique_ptr<Var>($1),
-                std::unique_ptr<Exp>($3));
+        $$ = state.arena->make<SubscriptVar>(Location(@1.offset),
+                unique_ptr<Var>($1),
+                unique_ptr<Exp>($3));
     };
 
 exps: /*empty*/ {
-        $$ = new std::vector<std::unique_ptr<Exp>>();
+        $$ = state.arena->make<std::vector<unique_ptr<Exp>>>();
     }
     | exp {
-        $$ = new std::vector<std::unique_ptr<Exp>>();
-        $$->push_back(std::unique_ptr<Exp>($1));
+        $$ = state.arena->make<std::vector<unique_ptr<Exp>>>();
+        $$->push_back(unique_ptr<Exp>($1));
     }
     | exp SEMICOLON exps {
         $$ = $3;
-        $3->push_back(std::unique_ptr<Exp>($1));
+        $3->push_back(unique_ptr<Exp>($1));
     };
 
 decs: /*empty*/ {
-        $$ = new std::vector<std::unique_ptr<Dec>>();
+        $$ = state.arena->make<std::vector<unique_ptr<Dec>>>();
     }
     | dec decs {
         $$ = $2;
-        $2->push_back(std::unique_ptr<Dec>($1));
+        $2->push_back(unique_ptr<Dec>($1));
     };
 
 dec:
@@ -319,36 +401,30 @@ dec:
 
 tydec:
     TYPE id EQ ty {
-        $$ = new TypeDec(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<TypeDec>(Location(@1.offset),
                 *$2,
-                std::unique_ptr<Type>($4));
-        
-        delete $2;
+                unique_ptr<Type>($4));
     };
 
 ty:
     /*Type alias.*/
     id {
-        $$ = new NameType(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<NameType>(Location(@1.offset),
                 *$1);
-        
-        delete $1;
     }
     /*Record type definition.*/
     | LBRACE tyfields RBRACE {
-        $$ = new RecordType(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<RecordType>(Location(@1.offset),
                 std::move(*$2));
     }
     /*Array type definition.*/
     | ARRAY OF id {
-        $$ = new ArrayType(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<ArrayType>(Location(@1.offset),
                 *$3);
-
-        delete $3;
     };
 
 tyfields: /*empty*/ {
-        $$ = new std::vector<std::unique_ptr<Field>>();
+        $$ = state.arena->make<std::vector<unique_ptr<Field>>>();
     } 
     | tyfield_list {
         $$ = $1;
@@ -356,74 +432,60 @@ tyfields: /*empty*/ {
 
 tyfield_list:
     tyfield {
-        $$ = new std::vector<std::unique_ptr<Field>>();
-        $$->push_back(std::unique_ptr<Field>($1));
+        $$ = state.arena->make<std::vector<unique_ptr<Field>>>();
+        $$->push_back(unique_ptr<Field>($1));
     }
     | tyfield COMMA tyfield_list {
         $$ = $3;
-        $3->push_back(std::unique_ptr<Field>($1));
+        $3->push_back(unique_ptr<Field>($1));
     };
 
 tyfield:
     id COLON id {
-        $$ = new Field(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<Field>(Location(@1.offset),
                 *$1,
                 *$3);
-
-        delete $1;
-        delete $3;
     };
 
 vardec:
     VAR id ASSIGN exp {
-        $$ = new VarDec(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<VarDec>(Location(@1.offset),
                     *$2,
                     nullptr,
-                    std::unique_ptr<Exp>($4));
-        
-        delete $2;
+                    unique_ptr<Exp>($4));
     }
     | VAR id COLON id ASSIGN exp {
-        $$ = new VarDec(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<VarDec>(Location(@1.offset),
                     *$2,
-                    std::make_unique<NameType>(Location(@4.first_line, @4.first_column),
+                    state.arena->makeUnique<NameType>(Location(@4.offset),
                         *$4),
-                    std::unique_ptr<Exp>($6));
-        
-        delete $2;
-        delete $4;
+                    unique_ptr<Exp>($6));
     };
 
 fundec:
     FUNCTION id LPAREN tyfields RPAREN EQ exp {
-        $$ = new FunctionDec(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<FunctionDec>(Location(@1.offset),
                     *$2,
-                    std::make_unique<Prototype>(Location(@1.first_line, @1.first_column), 
-                        *$2, std::move(*$4), Identifier(Location(@1.first_line, @1.first_column), "")),
-                    std::unique_ptr<Exp>($7));
-        
-        delete $2;
+                    state.arena->makeUnique<Prototype>(Location(@1.offset), 
+                        *$2, std::move(*$4), Identifier(Location(@1.offset), Symbol())),
+                    unique_ptr<Exp>($7));
     }
     | FUNCTION id LPAREN tyfields RPAREN COLON id EQ exp {
-        $$ = new FunctionDec(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<FunctionDec>(Location(@1.offset),
                     *$2,
-                    std::make_unique<Prototype>(Location(@1.first_line, @1.first_column),
+                    state.arena->makeUnique<Prototype>(Location(@1.offset),
                         *$2, std::move(*$4), *$7),
-                    std::unique_ptr<Exp>($9));
-        
-        delete $2;
-        delete $7;
+                    unique_ptr<Exp>($9));
     }
 
 id:
     ID {
-        $$ = new Identifier(Location(@1.first_line, @1.first_column),
-                *$1);
-        delete $1;
+        $$ = state.arena->make<Identifier>(Location(@1.offset),
+                $1);
     };
 
 arguments: /*empty*/ {
-        $$ = new std::vector<std::unique_ptr<Exp>>();
+        $$ = state.arena->make<std::vector<unique_ptr<Exp>>>();
     }
     | argument_list {
         $$ = $1;
@@ -431,16 +493,16 @@ arguments: /*empty*/ {
 
 argument_list:
     exp {
-        $$ = new std::vector<std::unique_ptr<Exp>>();
-        $$->push_back(std::unique_ptr<Exp>($1));
+        $$ = state.arena->make<std::vector<unique_ptr<Exp>>>();
+        $$->push_back(unique_ptr<Exp>($1));
     }
     | exp COMMA argument_list {
         $$ = $3;
-        $3->push_back(std::unique_ptr<Exp>($1));
+        $3->push_back(unique_ptr<Exp>($1));
     };
 
 atribuitions: /*empty*/ {
-        $$ = new std::vector<std::unique_ptr<FieldExp>>();
+        $$ = state.arena->make<std::vector<unique_ptr<FieldExp>>>();
     }
     | atribuition_list {
         $$ = $1;
@@ -448,18 +510,54 @@ atribuitions: /*empty*/ {
 
 atribuition_list:
     id EQ exp {
-        $$ = new std::vector<std::unique_ptr<FieldExp>>();
-        $$->push_back(std::make_unique<FieldExp>(Location(@1.first_line, @1.first_column),
+        $$ = state.arena->make<std::vector<unique_ptr<FieldExp>>>();
+        $$->push_back(state.arena->makeUnique<FieldExp>(Location(@1.offset),
                         *$1,
-                        std::unique_ptr<Exp>($3)));
-        
-        delete $1;
+                        unique_ptr<Exp>($3)));
     }
     | id EQ exp COMMA atribuition_list {
         $$ = $5;
-        $5->push_back(std::make_unique<FieldExp>(Location(@1.first_line, @1.first_column),
+        $5->push_back(state.arena->makeUnique<FieldExp>(Location(@1.offset),
                         *$1,
-                        std::unique_ptr<Exp>($3)));
-        
-        delete $1;
-    };
\ No newline at end of file
+                        unique_ptr<Exp>($3)));
+    };
+
+%%
+
+int yylex_init_extra(ParserState *state, yyscan_t *scanner);
+struct yy_buffer_state *yy_scan_buffer(char *base, size_t size, yyscan_t scanner);
+int yylex_destroy(yyscan_t scanner);
+int prattParse(yyscan_t scanner, ParserState &state);
+
+std::unique_ptr<Root> parse(FILE *in, ParserKind kind, std::ostream &diagnostics) {
+    auto lineTable = LineTable::load(in);
+    if (!lineTable) {
+        return nullptr;
+    }
+
+    ParserState state;
+    state.lineTable = lineTable.get();
+    state.diagnostics = &diagnostics;
+    yyscan_t scanner;
+
+    if (yylex_init_extra(&state, &scanner) != 0) {
+        return nullptr;
+    }
+
+    if (!yy_scan_buffer(lineTable->getScanBuffer(), lineTable->getSource().size() + 2, scanner)) {
+        yylex_destroy(scanner);
+        return nullptr;
+    }
+
+    int result = kind == ParserKind::Pratt ? prattParse(scanner, state) : yyparse(scanner, state);
+    yylex_destroy(scanner);
+
+    if (result != 0) {
+        return nullptr;
+    }
+
+    state.root->setArena(std::move(state.arena));
+    state.root->setLineTable(std::move(lineTable));
+
+    return std::move(state.root);
+}
@@ -0,0 +1,167 @@
+#include "buildcache.hpp"
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <algorithm>
+#include <tuple>
+
+static std::string executableAnchor;
+
+/* A store that left its unique file for longer than this has crashed. */
+static const auto staleTemporaryAge = std::chrono::hours(1);
+
+/* The tc executable is identified by its path, size and modification time, any rebuild changes the keys. */
+static std::string compilerVersion(const char *argv0) {
+    auto executable = llvm::sys::fs::getMainExecutable(argv0, &executableAnchor);
+
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(executable, status)) {
+        return executable + " " LLVM_VERSION_STRING;
+    }
+
+    return executable + " " LLVM_VERSION_STRING
+           + " " + std::to_string(status.getSize())
+           + " " + std::to_string(llvm::sys::toTimeT(status.getLastModificationTime()));
+}
+
+BuildCache::BuildCache(std::string dir, std::uint64_t maxSize, const char *argv0)
+        : dir_(std::move(dir)), maxSize_(maxSize), compiler_(compilerVersion(argv0)) {}
+
+std::string BuildCache::defaultDirectory() {
+    llvm::SmallString<128> path;
+    if (!llvm::sys::path::home_directory(path)) {
+        return "";
+    }
+
+    llvm::sys::path::append(path, ".cache", "tiger-compiler", "build");
+
+    return path.str().str();
+}
+
+std::string BuildCache::key(std::string const &source,
+                            std::vector<std::string> const &flags,
+                            std::vector<std::string> const &libs) const {
+    llvm::MD5 md5;
+    md5.update(compiler_);
+
+    for (auto &flag : flags) {
+        md5.update(flag);
+        md5.update(llvm::StringRef("", 1));
+    }
+
+    auto buffer = llvm::MemoryBuffer::getFile(source);
+    if (!buffer) {
+        return "";
+    }
+    md5.update((*buffer)->getBuffer());
+
+    for (auto &lib : libs) {
+        auto libBuffer = llvm::MemoryBuffer::getFile(lib);
+        if (!libBuffer) {
+            return "";
+        }
+        md5.update(lib);
+        md5.update((*libBuffer)->getBuffer());
+    }
+
+    llvm::MD5::MD5Result result;
+    md5.final(result);
+
+    return result.digest().str().str();
+}
+
+bool BuildCache::fetch(std::string const &key, std::string const &output) const {
+    llvm::SmallString<128> entry(dir_);
+    llvm::sys::path::append(entry, key);
+
+    int fd;
+    if (llvm::sys::fs::openFileForRead(entry, fd)) {
+        return false;
+    }
+    // the modification time orders the entries for the eviction
+    llvm::sys::fs::setLastAccessAndModificationTime(fd, std::chrono::system_clock::now());
+    llvm::sys::fs::closeFile(fd);
+
+    llvm::SmallString<128> tmp;
+    if (llvm::sys::fs::createUniqueFile(output + ".%%%%%%", tmp)) {
+        return false;
+    }
+    llvm::FileRemover remover(tmp);
+
+    if (llvm::sys::fs::copy_file(entry, tmp)
+        || llvm::sys::fs::setPermissions(tmp, llvm::sys::fs::all_read | llvm::sys::fs::all_exe
+                                              | llvm::sys::fs::owner_write)
+        || llvm::sys::fs::rename(tmp, output)) {
+        return false;
+    }
+    remover.releaseFile();
+
+    return true;
+}
+
+void BuildCache::store(std::string const &key, std::string const &executable) const {
+    if (llvm::sys::fs::create_directories(dir_)) {
+        return;
+    }
+
+    llvm::SmallString<128> entry(dir_);
+    llvm::sys::path::append(entry, key);
+
+    llvm::SmallString<128> tmp;
+    if (llvm::sys::fs::createUniqueFile(entry + ".%%%%%%", tmp)) {
+        return;
+    }
+    llvm::FileRemover remover(tmp);
+
+    if (llvm::sys::fs::copy_file(executable, tmp) || llvm::sys::fs::rename(tmp, entry)) {
+        return;
+    }
+    remover.releaseFile();
+
+    evict();
+}
+
+void BuildCache::evict() const {
+    std::vector<std::tuple<llvm::sys::TimePoint<>, std::uint64_t, std::string>> entries;
+    std::uint64_t total = 0;
+
+    auto now = std::chrono::system_clock::now();
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator it(dir_, EC), end; it != end && !EC; it.increment(EC)) {
+        llvm::sys::fs::file_status status;
+        if (llvm::sys::fs::status(it->path(), status) || status.type() != llvm::sys::fs::file_type::regular_file) {
+            continue;
+        }
+
+        // "key.%%%%%%" is the unique file of a store, in progress in another tc unless it is old
+        if (llvm::sys::path::filename(it->path()).contains('.')) {
+            if (now - status.getLastModificationTime() > staleTemporaryAge) {
+                llvm::sys::fs::remove(it->path());
+            }
+            continue;
+        }
+
+        entries.emplace_back(status.getLastModificationTime(), status.getSize(), it->path());
+        total += status.getSize();
+    }
+
+    if (total <= maxSize_) {
+        return;
+    }
+
+    // a concurrent tc may remove the same entries, a missing entry is just a miss
+    std::sort(entries.begin(), entries.end());
+    for (auto &entry : entries) {
+        if (total <= maxSize_) {
+            break;
+        }
+
+        llvm::sys::fs::remove(std::get<2>(entry));
+        total -= std::get<1>(entry);
+    }
+}
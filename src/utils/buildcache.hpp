@@ -0,0 +1,42 @@
+#ifndef BUILDCACHE_HPP
+#define BUILDCACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * On-disk cache of the generated executables, enabled with "-cache".
+ *
+ * An entry is keyed by the MD5 of the source, the tc executable, the options
+ * that change the generated code and the contents of the libs and of the
+ * inlined runtime bitcode (so a rebuilt runtime library invalidates it).
+ * Entries are written through a unique file and a rename, so concurrent tc
+ * runs never see a partial entry, and the least recently used ones are removed
+ * when the cache grows over its size. The unique files left by a crashed store
+ * are removed once they are old.
+ */
+class BuildCache {
+    std::string dir_;
+    std::uint64_t maxSize_;
+    std::string compiler_;
+
+    void evict() const;
+
+public:
+    BuildCache(std::string dir, std::uint64_t maxSize, const char *argv0);
+
+    static std::string defaultDirectory();
+
+    /* Returns "" when the source or a lib can not be read. */
+    std::string key(std::string const &source,
+                    std::vector<std::string> const &flags,
+                    std::vector<std::string> const &libs) const;
+
+    /* Copies the entry of "key" to "output", returns false on a miss. */
+    bool fetch(std::string const &key, std::string const &output) const;
+
+    void store(std::string const &key, std::string const &executable) const;
+};
+
+#endif  // BUILDCACHE_HPP
@@ -4,19 +4,46 @@
 CodeGenContext::CodeGenContext() {}
 
 void CodeGenContext::intrinsic() {
-    functions["print"] = createIntrinsicFunction("print", {stringType}, voidType);
-    functions["printd"] = createIntrinsicFunction("printd", {intType}, voidType);
-    functions["flush"] = createIntrinsicFunction("flush", {}, voidType);
-    functions["getchar"] = createIntrinsicFunction("getchar_", {}, stringType);
-    functions["ord"] = createIntrinsicFunction("ord", {stringType}, intType);
-    functions["chr"] = createIntrinsicFunction("chr", {intType}, stringType);
-    functions["size"] = createIntrinsicFunction("size", {stringType}, intType);
-    functions["substring"] = createIntrinsicFunction(
-            "substring", {stringType, intType, intType}, stringType);
-    functions["concat"] =
-            createIntrinsicFunction("concat", {stringType, stringType}, stringType);
-    functions["not"] = createIntrinsicFunction("not_", {intType}, intType);
-    functions["exit"] = createIntrinsicFunction("exit_", {intType}, voidType);
+    functions.push(Symbol("print"), createIntrinsicFunction("print", {stringType}, voidType));
+    functions.push(Symbol("printd"), createIntrinsicFunction("printd", {intType}, voidType));
+    functions.push(Symbol("flush"), createIntrinsicFunction("flush", {}, voidType));
+    functions.push(Symbol("getchar"), createIntrinsicFunction("getchar_", {}, stringType));
+    functions.push(Symbol("ord"), createIntrinsicFunction("ord", {stringType}, intType));
+    functions.push(Symbol("chr"), createIntrinsicFunction("chr", {intType}, stringType));
+    functions.push(Symbol("size"), createIntrinsicFunction("size", {stringType}, intType));
+    functions.push(Symbol("substring"), createIntrinsicFunction(
+            "substring", {stringType, intType, intType}, stringType));
+    functions.push(Symbol("concat"),
+            createIntrinsicFunction("concat", {stringType, stringType}, stringType));
+    functions.push(Symbol("not"), createIntrinsicFunction("not_", {intType}, intType));
+    functions.push(Symbol("exit"), createIntrinsicFunction("exit_", {intType}, voidType));
+}
+
+void CodeGenContext::useHostCPU(bool withFeatures) {
+    cpu = llvm::sys::getHostCPUName().str();
+
+    if (!withFeatures) {
+        return;
+    }
+
+    llvm::StringMap<bool> hostFeatures;
+    if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+        llvm::SubtargetFeatures subtargetFeatures(features);
+        for (auto &feature : hostFeatures) {
+            subtargetFeatures.AddFeature(feature.first(), feature.second);
+        }
+        features = subtargetFeatures.getString();
+    }
+}
+
+void CodeGenContext::addFeatures(std::string const &attrs) {
+    llvm::SubtargetFeatures subtargetFeatures(features);
+    llvm::SmallVector<llvm::StringRef, 8> attrList;
+    llvm::StringRef(attrs).split(attrList, ',', -1, false);
+    for (auto &attr : attrList) {
+        subtargetFeatures.AddFeature(attr);
+    }
+    features = subtargetFeatures.getString();
 }
 
 llvm::Function *CodeGenContext::createIntrinsicFunction(
@@ -26,7 +53,7 @@ llvm::Function *CodeGenContext::createIntrinsicFunction(
     auto function = llvm::Function::Create(functionType,
                                            llvm::Function::ExternalLinkage,
                                            name, module.get());
-    functions.push(name, function);
+    functions.push(Symbol(name), function);
     return function;
 }
 
@@ -59,9 +86,16 @@ llvm::Value *CodeGenContext::convertNil(llvm::Value *val, llvm::Value *ptr) {
     return val;
 }
 
+void CodeGenContext::setDiagnostics(std::ostream &stream) {
+    diagnostics = &stream;
+    ownedErrs = std::make_unique<llvm::raw_os_ostream>(stream);
+    ownedErrs->SetUnbuffered();
+    errs = ownedErrs.get();
+}
+
 llvm::Value *CodeGenContext::logErrorV(std::string const &msg) {
     hasError = true;
-    std::cerr << msg << std::endl;
+    *diagnostics << msg << std::endl;
     return nullptr;
 }
 
@@ -74,6 +108,60 @@ llvm::AllocaInst *CodeGenContext::createEntryBlockAlloca(llvm::Function *functio
     return TmpB.CreateAlloca(type, size, name);
 }
 
+llvm::Value *CodeGenContext::createFrame(llvm::Function *function,
+                                         llvm::Value *link,
+                                         std::vector<AST::VarDec *> const &variables) {
+    std::vector<llvm::Type *> fields;
+    for (size_t level = 1; level < currentLevel; ++level) {
+        fields.push_back(llvm::PointerType::getUnqual(staticLink[currentLevel - level]));
+    }
+
+    for (auto &var : variables) {
+        if (var->isEscaping()) {
+            var->setOffset(fields.size());
+            fields.push_back(var->getType());
+        }
+    }
+
+    staticLink.front()->setBody(fields);
+    if (currentLevel == 0) {
+        return new llvm::GlobalVariable(*module, staticLink.front(), false,
+                                        llvm::GlobalValue::InternalLinkage,
+                                        llvm::ConstantAggregateZero::get(staticLink.front()),
+                                        "frame");
+    }
+
+    auto frame = createEntryBlockAlloca(function, staticLink.front(), "frame");
+
+    // only the levels the parent reaches are copied, none without a static link
+    auto enclosing = std::move(display);
+    display.assign(currentLevel, nullptr);
+    if (link) {
+        for (size_t level = 1; level + 1 < currentLevel; ++level) {
+            if (enclosing[level]) {
+                display[level] = builder.CreateLoad(builder.CreateStructGEP(link, level - 1), "display");
+            }
+        }
+        display[currentLevel - 1] = link;
+    }
+
+    for (size_t level = 1; level < currentLevel; ++level) {
+        if (display[level]) {
+            builder.CreateStore(display[level], builder.CreateStructGEP(frame, level - 1));
+        }
+    }
+
+    return frame;
+}
+
+llvm::Value *CodeGenContext::frameOf(size_t level) {
+    if (level == currentLevel) {
+        return currentFrame;
+    }
+
+    return level == 0 ? mainFrame : display[level];
+}
+
 llvm::Type *CodeGenContext::getElementType(llvm::Type *type) {
     return llvm::cast<llvm::PointerType>(type)->getElementType();
 }
@@ -115,28 +203,20 @@ bool CodeGenContext::isMatch(llvm::Type *a, llvm::Type *b) {
 llvm::Type *CodeGenContext::logErrorT(std::string const &msg,
                                       AST::Location const &loc) {
     hasError = true;
-    std::cerr << loc.getFirstLine() << ":" << loc.getFirstColumn() << ": "
+    *diagnostics << lineTable->getLine(loc.getOffset()) << ":"
+              << lineTable->getColumn(loc.getOffset()) << ": "
               << "Error: " << msg << std::endl;
     return nullptr;
 }
 
-llvm::Type *CodeGenContext::typeOf(const AST::Location &loc,
-                                   std::string const &name,
-                                   std::set<std::string> &parentName) {
-    if (auto type = types[name]) {
-        return type;
+llvm::Type *CodeGenContext::typeOf(const AST::Location &loc, Symbol name) {
+    if (auto typeDec = typeDecs[name]) {
+        return typeDec->resolve(*this);
     }
 
-    auto typeDec = typeDecs[name];
-    if (!typeDec) {
-        return logErrorT(name + " is not a type", loc);
+    if (auto type = types[name]) {
+        return type;
     }
 
-    return typeDec->traverse(parentName, *this);
-}
-
-llvm::Type *CodeGenContext::typeOf(const AST::Location &loc, const std::string &name) {
-    std::set<std::string> parentName;
-
-    return typeOf(loc, name, parentName);
+    return logErrorT(name.getName() + " is not a type", loc);
 }
@@ -12,15 +12,19 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/MC/SubtargetFeature.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Host.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_os_ostream.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
+#include "utils/phasetimer.hpp"
 #include "utils/symboltable.hpp"
 
+#include <iostream>
 #include <set>
 
 namespace AST {
@@ -30,34 +34,72 @@ namespace AST {
 
     class FunctionDec;
 
+    class CallExp;
+
     class Location;
 
     class Dec;
 }  // namespace AST
 
+class BuildCache;
+
+class LineTable;
+
 class CodeGenContext {
 public:
-    std::string outputFileO = "object.o";
     std::string outputFileE = "output";
     std::string outputFileI = "";
+    std::string outputFileAst = "";
+    std::vector<std::string> objectFiles;
     std::vector<std::string> libs;
+    std::string linker = "ld";
+    std::string parser = "bison";
+    bool fromAst{false};
+    unsigned optLevel = 0;
+    std::string cpu = "generic";
+    std::string features = "";
+    llvm::CodeGenOpt::Level codeGenOptLevel = llvm::CodeGenOpt::Default;
+    std::string runtimeBitcode = "";
+    unsigned codegenPartitions = 1;
+
+    bool jit{false};
+    PhaseTimer timer;
+    BuildCache const *cache{nullptr};
+    LineTable const *lineTable{nullptr};
 
     bool hasError{false};
-    llvm::LLVMContext context;
+    /* Where the errors of the compilation are written, std::cerr unless
+     * setDiagnostics collects them, and the same stream for the LLVM APIs. */
+    std::ostream *diagnostics{&std::cerr};
+    std::unique_ptr<llvm::raw_os_ostream> ownedErrs;
+    llvm::raw_ostream *errs{&llvm::errs()};
+    std::unique_ptr<llvm::LLVMContext> ownedContext{std::make_unique<llvm::LLVMContext>()};
+    llvm::LLVMContext &context{*ownedContext};
     llvm::IRBuilder<> builder{context};
     std::unique_ptr<llvm::Module> module{std::make_unique<llvm::Module>("main", context)};
     SymbolTable<AST::VarDec> valueDecs;
     AST::Dec *lastDec;
-    SymbolTable<llvm::Value> namedValues;
     SymbolTable<llvm::Type> types;
     SymbolTable<AST::Type> typeDecs;
     llvm::Function *mainFunction;
     llvm::TargetMachine *targetMachine;
     SymbolTable<llvm::Function> functions;
     SymbolTable<AST::FunctionDec> functionDecs;
+    /* Every function declared by the program, the calls to them, and the
+     * function being traversed. */
+    std::vector<AST::FunctionDec *> declaredFunctions;
+    std::vector<AST::CallExp *> calls;
+    AST::FunctionDec *currentFunction{nullptr};
+    /* The number of variable declarations traversed so far. */
+    size_t declaredVariables{0u};
     std::deque<llvm::StructType *> staticLink;
     llvm::AllocaInst *oldFrame{nullptr};
-    llvm::AllocaInst *currentFrame;
+    llvm::Value *currentFrame;
+    /* main is not recursive, its frame is a global that every level reaches directly. */
+    llvm::Value *mainFrame;
+    /* The frames of the enclosing levels of the current function, read once on
+     * entry, nullptr for the levels it does not reach. */
+    std::vector<llvm::Value *> display;
     size_t currentLevel = 0;
     llvm::Type *intType{llvm::Type::getInt64Ty(context)};
     llvm::Type *voidType{llvm::Type::getVoidTy(context)};
@@ -78,6 +120,8 @@ public:
     llvm::Value *zero{llvm::ConstantInt::get(intType, llvm::APInt(64, 0))};
     llvm::Value *one{llvm::ConstantInt::get(intType, llvm::APInt(64, 1))};
 
+    void setDiagnostics(std::ostream &stream);
+
     llvm::Value *logErrorV(std::string const &msg);
 
     llvm::AllocaInst *createEntryBlockAlloca(llvm::Function *function,
@@ -85,6 +129,17 @@ public:
                                              const std::string &name,
                                              llvm::Value *size = nullptr);
 
+    /* Allocates the frame of the current level, "staticLink.front()": the
+     * display, i.e. the frames of the enclosing levels above main copied from
+     * the frame "link" of the parent, then the escaping variables of
+     * "variables". Sets "display" for the current function. */
+    llvm::Value *createFrame(llvm::Function *function,
+                                  llvm::Value *link,
+                                  std::vector<AST::VarDec *> const &variables);
+
+    /* The frame of the function of level "level", the current one or one of the display. */
+    llvm::Value *frameOf(size_t level);
+
     llvm::Type *getElementType(llvm::Type *type);
 
     bool isNil(llvm::Type *exp);
@@ -105,13 +160,14 @@ public:
 
     void intrinsic();
 
+    void useHostCPU(bool withFeatures);
+
+    void addFeatures(std::string const &attrs);
+
     llvm::Type *logErrorT(std::string const &msg,
                           AST::Location const &loc);
 
-    llvm::Type *typeOf(const AST::Location &loc, std::string const &name,
-                       std::set<std::string> &parentName);
-
-    llvm::Type *typeOf(const AST::Location &loc, const std::string &name);
+    llvm::Type *typeOf(const AST::Location &loc, Symbol name);
 
     std::stack<bool> inLoopStack;
 
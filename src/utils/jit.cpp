@@ -0,0 +1,87 @@
+#include "jit.hpp"
+#include "codegencontext.hpp"
+#include "runtime.hpp"
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+
+static llvm::Error defineRuntime(llvm::orc::LLJIT &jit) {
+    llvm::orc::SymbolMap symbols;
+    auto define = [&](llvm::StringRef name, void *address) {
+        symbols[jit.mangleAndIntern(name)] =
+                llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(address),
+                                         llvm::JITSymbolFlags::Exported);
+    };
+
+    define("print", (void *) &print);
+    define("printd", (void *) &printd);
+    define("allocaRecord", (void *) &allocaRecord);
+    define("allocaArray", (void *) &allocaArray);
+    define("flush", (void *) &flush);
+    define("getchar_", (void *) &getchar_);
+    define("ord", (void *) &ord);
+    define("chr", (void *) &chr);
+    define("size", (void *) &size);
+    define("substring", (void *) &substring);
+    define("concat", (void *) &concat);
+    define("not_", (void *) &not_);
+    define("exit_", (void *) &exit_);
+    define("strcmp_", (void *) &strcmp_);
+
+    return jit.getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(symbols)));
+}
+
+static bool logError(CodeGenContext &context, llvm::Error error) {
+    llvm::logAllUnhandledErrors(std::move(error), *context.errs, "JIT: ");
+    return false;
+}
+
+bool runJIT(CodeGenContext &context, int &result) {
+    auto targetMachineBuilder = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!targetMachineBuilder) {
+        return logError(context, targetMachineBuilder.takeError());
+    }
+
+    if (context.cpu != "generic") {
+        targetMachineBuilder->setCPU(context.cpu);
+    }
+    if (!context.features.empty()) {
+        targetMachineBuilder->addFeatures(llvm::SubtargetFeatures(context.features).getFeatures());
+    }
+    targetMachineBuilder->setCodeGenOptLevel(context.codeGenOptLevel);
+
+    auto jit = llvm::orc::LLJITBuilder()
+            .setJITTargetMachineBuilder(std::move(*targetMachineBuilder))
+            .create();
+    if (!jit) {
+        return logError(context, jit.takeError());
+    }
+
+    if (auto error = defineRuntime(**jit)) {
+        return logError(context, std::move(error));
+    }
+
+    // the optimizer may introduce libc calls (memset, memcpy, ...)
+    auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            (*jit)->getDataLayout().getGlobalPrefix());
+    if (!process) {
+        return logError(context, process.takeError());
+    }
+    (*jit)->getMainJITDylib().addGenerator(std::move(*process));
+
+    llvm::orc::ThreadSafeModule module(std::move(context.module), std::move(context.ownedContext));
+    if (auto error = (*jit)->addIRModule(std::move(module))) {
+        return logError(context, std::move(error));
+    }
+
+    auto mainSymbol = (*jit)->lookup("main");
+    if (!mainSymbol) {
+        return logError(context, mainSymbol.takeError());
+    }
+
+    auto main = (std::int64_t (*)()) mainSymbol->getAddress();
+    result = (int) main();
+
+    return true;
+}
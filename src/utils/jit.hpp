@@ -0,0 +1,13 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+class CodeGenContext;
+
+/*
+ * Runs the "main" of the module built by Root::codegen through an ORC LLJIT,
+ * without object file or link. The runtime functions are resolved to the ones
+ * compiled into tc. "result" receives the value returned by "main".
+ */
+bool runJIT(CodeGenContext &context, int &result);
+
+#endif  // JIT_HPP
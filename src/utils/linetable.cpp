@@ -0,0 +1,87 @@
+#include "linetable.hpp"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+LineTable::LineTable(char *data, std::size_t size, std::size_t mapped) :
+        data_(data), size_(size), mapped_(mapped) {
+    lineStarts_.push_back(0);
+    auto end = data_ + size_;
+    for (auto newline = data_; (newline = static_cast<char *>(std::memchr(newline, '\n', end - newline)));) {
+        ++newline;
+        lineStarts_.push_back(newline - data_);
+    }
+}
+
+LineTable::~LineTable() {
+    if (mapped_) {
+        munmap(data_, mapped_);
+    } else {
+        delete[] data_;
+    }
+}
+
+std::unique_ptr<LineTable> LineTable::load(FILE *in) {
+    struct stat status;
+    int fd = fileno(in);
+
+    if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode)
+        && status.st_size > 0 && status.st_size < UINT32_MAX) {
+        std::size_t size = status.st_size;
+
+        // Reserve size + 2 zeroed bytes and map the file over their start: the
+        // two bytes after the text stay NUL whether or not the text ends on a
+        // page boundary.
+        auto base = mmap(nullptr, size + 2, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED) {
+            if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+                madvise(base, size, MADV_SEQUENTIAL);
+                return std::unique_ptr<LineTable>(new LineTable(static_cast<char *>(base), size, size + 2));
+            }
+
+            munmap(base, size + 2);
+        }
+    }
+
+    std::string source;
+    char buffer[BUFSIZ];
+    std::size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        source.append(buffer, size);
+    }
+
+    if (ferror(in)) {
+        return nullptr;
+    }
+
+    return copy(source);
+}
+
+std::unique_ptr<LineTable> LineTable::copy(llvm::StringRef source) {
+    if (source.size() >= UINT32_MAX) {
+        return nullptr;
+    }
+
+    auto data = new char[source.size() + 2];
+    std::memcpy(data, source.data(), source.size());
+    data[source.size()] = data[source.size() + 1] = '\0';
+
+    return std::unique_ptr<LineTable>(new LineTable(data, source.size(), 0));
+}
+
+unsigned LineTable::getLine(std::uint32_t offset) const {
+    return std::upper_bound(lineStarts_.begin(), lineStarts_.end(), offset) - lineStarts_.begin();
+}
+
+unsigned LineTable::getColumn(std::uint32_t offset) const {
+    unsigned column = 0;
+    auto end = std::min<std::size_t>(offset, size_);
+    for (auto i = lineStarts_[getLine(offset) - 1]; i < end; ++i) {
+        column += data_[i] == '\t' ? 8 - column % 8 : 1;
+    }
+
+    return column + 1;
+}
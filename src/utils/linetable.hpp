@@ -0,0 +1,56 @@
+#ifndef LINETABLE_HPP
+#define LINETABLE_HPP
+
+#include <llvm/ADT/StringRef.h>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+/*
+ * Source text of a program and the offsets where its lines start. The AST
+ * only records byte offsets; line and column are computed from them when a
+ * diagnostic is printed.
+ *
+ * Regular files are memory-mapped (privately, the scanner writes into its
+ * buffer), other inputs are read into the heap. Either way the text is
+ * followed by two NUL bytes, so flex scans it in place.
+ */
+class LineTable {
+    char *data_;
+    std::size_t size_;
+    std::size_t mapped_;  // length of the mapping, 0 when data_ is on the heap
+    std::vector<std::uint32_t> lineStarts_;
+
+    LineTable(char *data, std::size_t size, std::size_t mapped);
+
+public:
+    /* Loads the program read by "in", nullptr when it cannot be read. */
+    static std::unique_ptr<LineTable> load(FILE *in);
+
+    /* Copies "source" into the heap, nullptr when it is too large. */
+    static std::unique_ptr<LineTable> copy(llvm::StringRef source);
+
+    LineTable(LineTable const &) = delete;
+
+    LineTable &operator=(LineTable const &) = delete;
+
+    ~LineTable();
+
+    llvm::StringRef getSource() const {
+        return llvm::StringRef(data_, size_);
+    }
+
+    /* The text and its two trailing NUL bytes, as yy_scan_buffer takes them. */
+    char *getScanBuffer() const {
+        return data_;
+    }
+
+    /* 1-based line of the character at "offset". */
+    unsigned getLine(std::uint32_t offset) const;
+
+    /* 1-based column of the character at "offset", tabs stop every 8 columns. */
+    unsigned getColumn(std::uint32_t offset) const;
+};
+
+#endif  // LINETABLE_HPP
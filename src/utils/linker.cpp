@@ -0,0 +1,268 @@
+#include "linker.hpp"
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <iostream>
+
+#ifdef TIGER_LLD
+#include <lld/Common/Driver.h>
+#include <mutex>
+#endif
+
+static const std::string objectsPlaceholder = "@OBJECTS@";
+static const std::string outputPlaceholder = "@OUTPUT@";
+
+static bool isLinkerInput(llvm::StringRef lib) {
+    return lib.endswith(".o") || lib.endswith(".a") || lib.endswith(".so");
+}
+
+static std::string linkLinePath() {
+    llvm::SmallString<128> path;
+    if (!llvm::sys::path::home_directory(path)) {
+        return "";
+    }
+
+    llvm::sys::path::append(path, ".cache", "tiger-compiler", "link-line");
+
+    return path.str().str();
+}
+
+static bool execute(std::vector<std::string> const &args,
+                    std::ostream &err,
+                    llvm::Optional<llvm::StringRef> const &log = llvm::None) {
+    auto program = llvm::sys::findProgramByName(args.front());
+    if (!program) {
+        err << args.front() << " not found" << std::endl;
+        return false;
+    }
+
+    std::vector<llvm::StringRef> argv(args.begin(), args.end());
+    llvm::Optional<llvm::StringRef> redirects[] = {llvm::None, log, log};
+
+    return llvm::sys::ExecuteAndWait(*program, argv, llvm::None, redirects) == 0;
+}
+
+/* Runs a link command, with its output copied to "err". */
+static bool executeLink(std::vector<std::string> const &args, std::ostream &err) {
+    llvm::SmallString<128> log;
+    if (llvm::sys::fs::createTemporaryFile("tiger-link", "log", log)) {
+        return execute(args, err);
+    }
+    llvm::FileRemover logRemover(log);
+
+    auto ok = execute(args, err, log.str());
+    if (auto buffer = llvm::MemoryBuffer::getFile(log)) {
+        err << (*buffer)->getBuffer().str();
+    }
+
+    return ok;
+}
+
+/* Splits a command printed by "clang++ -###", where arguments may be quoted. */
+static std::vector<std::string> splitCommand(llvm::StringRef command) {
+    std::vector<std::string> args;
+
+    size_t i = 0;
+    while (i < command.size()) {
+        if (command[i] == ' ') {
+            ++i;
+            continue;
+        }
+
+        std::string arg;
+        if (command[i] == '"') {
+            for (++i; i < command.size() && command[i] != '"'; ++i) {
+                if (command[i] == '\\' && i + 1 < command.size()) {
+                    ++i;
+                }
+                arg += command[i];
+            }
+            ++i;
+        } else {
+            for (; i < command.size() && command[i] != ' '; ++i) {
+                arg += command[i];
+            }
+        }
+        args.push_back(arg);
+    }
+
+    return args;
+}
+
+/* Asks the clang++ driver for its link command of a placeholder object. */
+static std::vector<std::string> probeLinkLine(std::ostream &err) {
+    std::vector<std::string> line;
+
+    llvm::SmallString<128> object, log;
+    if (llvm::sys::fs::createTemporaryFile("tiger-probe", "o", object)
+        || llvm::sys::fs::createTemporaryFile("tiger-probe", "log", log)) {
+        return line;
+    }
+    llvm::FileRemover objectRemover(object);
+    llvm::FileRemover logRemover(log);
+
+    if (!execute({"clang++", "-###", object.str().str(), "-o", outputPlaceholder}, err, log.str())) {
+        return line;
+    }
+
+    auto buffer = llvm::MemoryBuffer::getFile(log);
+    if (!buffer) {
+        return line;
+    }
+
+    llvm::SmallVector<llvm::StringRef, 8> lines;
+    (*buffer)->getBuffer().split(lines, '\n', -1, false);
+    for (auto it = lines.rbegin(); it != lines.rend(); ++it) {
+        if (it->startswith(" ")) {
+            line = splitCommand(*it);
+            break;
+        }
+    }
+
+    for (auto &arg : line) {
+        if (arg == object.str()) {
+            arg = objectsPlaceholder;
+        }
+    }
+
+    return line;
+}
+
+static std::vector<std::string> loadLinkLine(std::ostream &err) {
+    auto path = linkLinePath();
+
+    if (!path.empty()) {
+        if (auto buffer = llvm::MemoryBuffer::getFile(path)) {
+            llvm::SmallVector<llvm::StringRef, 64> args;
+            (*buffer)->getBuffer().split(args, '\n', -1, false);
+
+            return std::vector<std::string>(args.begin(), args.end());
+        }
+    }
+
+    auto line = probeLinkLine(err);
+    if (line.empty() || path.empty()) {
+        return line;
+    }
+
+    // written to a unique file and renamed, so concurrent tc runs never see a partial line
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path));
+    llvm::SmallString<128> tmp;
+    int fd;
+    if (!llvm::sys::fs::createUniqueFile(path + ".%%%%%%", fd, tmp)) {
+        {
+            llvm::raw_fd_ostream out(fd, true);
+            for (auto &arg : line) {
+                out << arg << "\n";
+            }
+        }
+        if (llvm::sys::fs::rename(tmp, path)) {
+            llvm::sys::fs::remove(tmp);
+        }
+    }
+
+    return line;
+}
+
+static void removeLinkLine() {
+    auto path = linkLinePath();
+    if (!path.empty()) {
+        llvm::sys::fs::remove(path);
+    }
+}
+
+/* The cached line is stale when the toolchain was upgraded: a linker, crt file
+ * or library directory it names no longer exists. */
+static bool isStale(std::vector<std::string> const &line) {
+    return std::any_of(line.begin(), line.end(), [](std::string const &arg) {
+        llvm::StringRef path(arg);
+        path.consume_front("-L");
+
+        return path.startswith("/") && !llvm::sys::fs::exists(path);
+    });
+}
+
+static bool linkDirect(std::vector<std::string> const &line,
+                       bool inProcess,
+                       std::vector<std::string> const &objects,
+                       std::vector<std::string> const &libs,
+                       std::string const &output,
+                       std::ostream &err) {
+    std::vector<std::string> args;
+    for (auto &arg : line) {
+        if (arg == objectsPlaceholder) {
+            args.insert(args.end(), objects.begin(), objects.end());
+            args.insert(args.end(), libs.begin(), libs.end());
+        } else if (arg == outputPlaceholder) {
+            args.push_back(output);
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+#ifdef TIGER_LLD
+    if (inProcess) {
+        // lld keeps global state, only one link at a time
+        static std::mutex lldMutex;
+        std::lock_guard<std::mutex> lock(lldMutex);
+
+        args.front() = "ld.lld";
+        std::vector<const char *> argv;
+        for (auto &arg : args) {
+            argv.push_back(arg.c_str());
+        }
+
+        llvm::raw_os_ostream errs(err);
+        return lld::elf::link(argv, false, llvm::outs(), errs);
+    }
+#else
+    // without lld built in, main warned that "-fuse-ld=lld" links with ld
+    static_cast<void>(inProcess);
+#endif
+
+    return executeLink(args, err);
+}
+
+static bool linkDriver(std::vector<std::string> const &objects,
+                       std::vector<std::string> const &libs,
+                       std::string const &output,
+                       std::ostream &err) {
+    std::vector<std::string> args{"clang++"};
+    args.insert(args.end(), objects.begin(), objects.end());
+    args.insert(args.end(), libs.begin(), libs.end());
+    args.push_back("-o");
+    args.push_back(output);
+
+    return executeLink(args, err);
+}
+
+bool linkExecutable(std::string const &linker,
+                    std::vector<std::string> const &objects,
+                    std::vector<std::string> const &libs,
+                    std::string const &output,
+                    std::ostream &err) {
+    auto direct = linker != "clang++"
+                  && std::all_of(libs.begin(), libs.end(), isLinkerInput);
+
+    if (direct) {
+        auto line = loadLinkLine(err);
+        if (!line.empty() && isStale(line)) {
+            removeLinkLine();
+            line = loadLinkLine(err);
+        }
+        // the errors of a valid line (an undefined symbol, an unwritable output) are reported once
+        if (!line.empty()) {
+            return linkDirect(line, linker == "lld", objects, libs, output, err);
+        }
+    }
+
+    return linkDriver(objects, libs, output, err);
+}
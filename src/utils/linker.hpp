@@ -0,0 +1,29 @@
+#ifndef LINKER_HPP
+#define LINKER_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Links "objects" and "libs" into the "output" executable.
+ *
+ * linker:
+ *  - "ld": runs the system linker directly. The crt/libc link line of the
+ *          system is asked to the clang++ driver only once and cached in
+ *          "~/.cache/tiger-compiler/link-line", asked again when a file it
+ *          names no longer exists.
+ *  - "lld": same link line, but linked in-process through the lld library
+ *           (only when tc is built with "CONFIG+=lld").
+ *  - "clang++": runs the clang++ driver, as it is needed when a lib is a source file.
+ *
+ * Libs that are not objects or archives always go through the clang++ driver.
+ * The errors of the link are written to "err".
+ */
+bool linkExecutable(std::string const &linker,
+                    std::vector<std::string> const &objects,
+                    std::vector<std::string> const &libs,
+                    std::string const &output,
+                    std::ostream &err);
+
+#endif  // LINKER_HPP
@@ -0,0 +1,152 @@
+#include "phasetimer.hpp"
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <iomanip>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static const auto processStart = std::chrono::steady_clock::now();
+
+static double now() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - processStart).count();
+}
+
+static double threadCPUTime() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static long peakRSS() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+/* The bytes in use: the chunks of the heap and the large ones malloc maps on their own. */
+static long long allocatedBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    auto info = mallinfo2();
+    return (long long) (info.uordblks + info.hblkhd);
+#elif defined(__GLIBC__)
+    auto info = mallinfo();
+    return (long long) (unsigned) info.uordblks + (unsigned) info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+PhaseTimer::Scope::Scope(PhaseTimer &timer, std::string name) : timer_(timer) {
+    record_.name = std::move(name);
+    record_.file = timer.file;
+    record_.tid = timer.tid;
+    record_.depth = timer.depth_++;
+    record_.start = now();
+    cpuStart_ = threadCPUTime();
+    allocatedStart_ = allocatedBytes();
+}
+
+PhaseTimer::Scope::~Scope() {
+    record_.wall = now() - record_.start;
+    record_.cpu = threadCPUTime() - cpuStart_;
+    record_.peakRSS = peakRSS();
+    record_.allocated = allocatedBytes() - allocatedStart_;
+
+    timer_.depth_--;
+    timer_.records_.push_back(std::move(record_));
+}
+
+void PhaseTimer::append(PhaseTimer const &other) {
+    records_.insert(records_.end(), other.records_.begin(), other.records_.end());
+}
+
+void PhaseTimer::printTable(std::ostream &out) const {
+    struct Row {
+        Record total;
+        unsigned count;
+    };
+    std::vector<Row> rows;
+
+    for (auto it = records_.begin(); it != records_.end(); ++it) {
+        auto row = std::find_if(rows.begin(), rows.end(), [&it](Row const &row) {
+            return row.total.name == it->name && row.total.depth == it->depth;
+        });
+        if (row == rows.end()) {
+            rows.push_back({*it, 1});
+            continue;
+        }
+        row->total.wall += it->wall;
+        row->total.cpu += it->cpu;
+        row->total.peakRSS = std::max(row->total.peakRSS, it->peakRSS);
+        row->total.allocated += it->allocated;
+        row->count++;
+    }
+    // records are pushed when a phase ends, order the rows by the start of the phases
+    std::stable_sort(rows.begin(), rows.end(), [](Row const &a, Row const &b) {
+        return a.total.start < b.total.start;
+    });
+
+    out << std::left << std::setw(24) << "Phase" << std::right
+        << std::setw(8) << "Count"
+        << std::setw(12) << "Wall (ms)"
+        << std::setw(12) << "CPU (ms)"
+        << std::setw(14) << "Peak RSS (MB)"
+        << std::setw(16) << "Allocated (MB)" << std::endl;
+
+    out << std::fixed << std::setprecision(2);
+    for (auto &row : rows) {
+        out << std::left << std::setw(24) << std::string(row.total.depth * 2, ' ') + row.total.name << std::right
+            << std::setw(8) << row.count
+            << std::setw(12) << row.total.wall / 1e3
+            << std::setw(12) << row.total.cpu / 1e3
+            << std::setw(14) << row.total.peakRSS / 1024.0
+            << std::setw(16) << row.total.allocated / (1024.0 * 1024.0) << std::endl;
+    }
+    out << std::defaultfloat;
+}
+
+static std::string escape(std::string const &str) {
+    std::string escaped;
+
+    for (auto c : str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+bool PhaseTimer::writeTrace(std::string const &path) const {
+    std::error_code EC;
+    llvm::raw_fd_ostream out(path, EC, llvm::sys::fs::F_None);
+
+    if (EC) {
+        llvm::errs() << "Could not open file: " << EC.message() << "\n";
+        return false;
+    }
+
+    out << "{\"traceEvents\":[\n";
+    for (size_t i = 0; i < records_.size(); i++) {
+        auto &record = records_[i];
+
+        out << "{\"name\":\"" << escape(record.name) << "\",\"cat\":\"phase\",\"ph\":\"X\""
+            << ",\"pid\":1,\"tid\":" << record.tid
+            << ",\"ts\":" << llvm::format("%.3f", record.start)
+            << ",\"dur\":" << llvm::format("%.3f", record.wall)
+            << ",\"args\":{\"file\":\"" << escape(record.file) << "\""
+            << ",\"cpu_us\":" << llvm::format("%.3f", record.cpu)
+            << ",\"peak_rss_kb\":" << record.peakRSS
+            << ",\"allocated_bytes\":" << record.allocated << "}}"
+            << (i + 1 < records_.size() ? ",\n" : "\n");
+    }
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+
+    return !out.has_error();
+}
@@ -0,0 +1,67 @@
+#ifndef PHASETIMER_HPP
+#define PHASETIMER_HPP
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Wall time, CPU time (of the calling thread), peak RSS and heap growth of
+ * the compiler phases.
+ *
+ * Peak RSS and the allocated bytes are sampled for the whole process, so in
+ * the "-j" mode they include the files compiled at the same time.
+ */
+class PhaseTimer {
+public:
+    struct Record {
+        std::string name;
+        std::string file;
+        unsigned tid;
+        unsigned depth;
+        double start;       // us since the start of tc
+        double wall;        // us
+        double cpu;         // us
+        long peakRSS;       // KB
+        long long allocated;  // bytes
+    };
+
+    /* Times the enclosing block as the phase "name". */
+    class Scope {
+        PhaseTimer &timer_;
+        Record record_;
+        double cpuStart_;
+        long long allocatedStart_;
+
+    public:
+        Scope(PhaseTimer &timer, std::string name);
+
+        Scope(Scope const &) = delete;
+
+        Scope &operator=(Scope const &) = delete;
+
+        ~Scope();
+    };
+
+    std::string file;
+    unsigned tid{0};
+
+    const std::vector<Record> &records() const {
+        return records_;
+    }
+
+    void append(PhaseTimer const &other);
+
+    /* One line per phase name, summed over every file. */
+    void printTable(std::ostream &out) const;
+
+    /* Chrome trace-event JSON, loadable in chrome://tracing and Perfetto. */
+    bool writeTrace(std::string const &path) const;
+
+private:
+    std::vector<Record> records_;
+    unsigned depth_{0};
+};
+
+#endif  // PHASETIMER_HPP
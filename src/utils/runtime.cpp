@@ -1,3 +1,4 @@
+#include "runtime.hpp"
 #include <cstring>
 #include <iostream>
 
@@ -34,23 +35,23 @@ char *getchar_() {
     }
 }
 
-int ord(char *c) {
+std::int64_t ord(char *c) {
     if (*c > 127 || *c < 0)
         return -1;
     else
         return (int) *c;
 }
 
-char *chr(int c) {
+char *chr(std::int64_t c) {
     if (c > 127 || c < 0) exit(-1);
     return new char[2]{(char) (c), '\0'};
 }
 
-int size(char *c) { 
+std::int64_t size(char *c) { 
     return std::strlen(c);
 }
 
-char *substring(char *s, int first, int n) {
+char *substring(char *s, std::int64_t first, std::int64_t n) {
     char *result = new char[n + 1];
     memcpy(result, s + first, n);
     result[n] = '\0';
@@ -67,15 +68,15 @@ char *concat(char *s1, char *s2) {
     return result;
 }
 
-int not_(int i) {
+std::int64_t not_(std::int64_t i) {
     return i == 0;
 }
 
-void exit_(int i) {
+void exit_(std::int64_t i) {
     exit(i);
 }
 
-int strcmp_(char *a, char *b) {
+std::int64_t strcmp_(char *a, char *b) {
     return std::strcmp(a, b);
 }
 
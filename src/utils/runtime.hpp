@@ -0,0 +1,39 @@
+#ifndef RUNTIME_HPP
+#define RUNTIME_HPP
+
+#include <cstdint>
+
+/* Runtime functions called by the generated code, see CodeGenContext::intrinsic(). */
+extern "C" {
+
+void print(char *c);
+
+void printd(std::uint64_t digit);
+
+std::uint8_t *allocaRecord(std::uint64_t size);
+
+std::uint8_t *allocaArray(std::uint64_t size, std::uint64_t elementSize);
+
+void flush();
+
+char *getchar_();
+
+std::int64_t ord(char *c);
+
+char *chr(std::int64_t c);
+
+std::int64_t size(char *c);
+
+char *substring(char *s, std::int64_t first, std::int64_t n);
+
+char *concat(char *s1, char *s2);
+
+std::int64_t not_(std::int64_t i);
+
+void exit_(std::int64_t i);
+
+std::int64_t strcmp_(char *a, char *b);
+
+}
+
+#endif  // RUNTIME_HPP
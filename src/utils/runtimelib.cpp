@@ -0,0 +1,165 @@
+#include "runtimelib.hpp"
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Object/ArchiveWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+#include <iostream>
+
+#ifndef TIGER_RUNTIME_SOURCE
+#define TIGER_RUNTIME_SOURCE "src/utils/runtime.cpp"
+#endif
+
+static std::string hashFile(std::string const &path) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer) {
+        return "";
+    }
+
+    llvm::MD5 md5;
+    md5.update((*buffer)->getBuffer());
+    llvm::MD5::MD5Result result;
+    md5.final(result);
+
+    return result.digest().str().str();
+}
+
+static std::string readFile(std::string const &path) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer) {
+        return "";
+    }
+
+    return (*buffer)->getBuffer().trim().str();
+}
+
+/* Writes through a unique file and a rename, so concurrent tc runs never see a partial file. */
+static bool writeFile(std::string const &path, llvm::StringRef content) {
+    llvm::SmallString<128> tmp;
+    int fd;
+    if (llvm::sys::fs::createUniqueFile(path + ".%%%%%%", fd, tmp)) {
+        return false;
+    }
+
+    {
+        llvm::raw_fd_ostream out(fd, true);
+        out << content;
+    }
+
+    if (llvm::sys::fs::rename(tmp, path)) {
+        llvm::sys::fs::remove(tmp);
+        return false;
+    }
+
+    return true;
+}
+
+static bool compile(std::string const &source,
+                    std::string const &output,
+                    bool bitcode) {
+    auto clang = llvm::sys::findProgramByName("clang++");
+    if (!clang) {
+        std::cerr << "clang++ not found, can not build the runtime library" << std::endl;
+        return false;
+    }
+
+    std::vector<llvm::StringRef> args{"clang++", "-O2", "-fPIC", "-c", source, "-o", output};
+    if (bitcode) {
+        args.push_back("-emit-llvm");
+    }
+
+    return llvm::sys::ExecuteAndWait(*clang, args) == 0;
+}
+
+static std::string mainExecutableAnchor;
+
+RuntimeLibrary::RuntimeLibrary(std::string dir) : dir_(std::move(dir)) {}
+
+std::string RuntimeLibrary::defaultDirectory(const char *argv0) {
+    auto executable = llvm::sys::fs::getMainExecutable(argv0, &mainExecutableAnchor);
+
+    return llvm::sys::path::parent_path(executable).str();
+}
+
+std::string RuntimeLibrary::archive() const {
+    llvm::SmallString<128> path(dir_);
+    llvm::sys::path::append(path, "libtigerrt.a");
+
+    return path.str().str();
+}
+
+std::string RuntimeLibrary::bitcode() const {
+    llvm::SmallString<128> path(dir_);
+    llvm::sys::path::append(path, "libtigerrt.bc");
+
+    return path.str().str();
+}
+
+bool RuntimeLibrary::build(std::string const &source) {
+    llvm::SmallString<128> object, bc;
+    if (llvm::sys::fs::createUniqueFile(archive() + ".%%%%%%.o", object)
+        || llvm::sys::fs::createUniqueFile(bitcode() + ".%%%%%%", bc)) {
+        return false;
+    }
+    llvm::FileRemover objectRemover(object);
+    llvm::FileRemover bcRemover(bc);
+
+    if (!compile(source, object.str().str(), false) || !compile(source, bc.str().str(), true)) {
+        return false;
+    }
+
+    auto member = llvm::NewArchiveMember::getFile(object, true);
+    if (!member) {
+        llvm::consumeError(member.takeError());
+        return false;
+    }
+
+    llvm::SmallString<128> tmpArchive;
+    if (llvm::sys::fs::createUniqueFile(archive() + ".%%%%%%", tmpArchive)) {
+        return false;
+    }
+    llvm::FileRemover archiveRemover(tmpArchive);
+
+    member->MemberName = "runtime.o";
+    std::vector<llvm::NewArchiveMember> members;
+    members.push_back(std::move(*member));
+    if (auto error = llvm::writeArchive(tmpArchive, members, true, llvm::object::Archive::K_GNU, true, false)) {
+        llvm::consumeError(std::move(error));
+        return false;
+    }
+
+    if (llvm::sys::fs::rename(tmpArchive, archive()) || llvm::sys::fs::rename(bc, bitcode())) {
+        return false;
+    }
+
+    llvm::SmallString<128> hashPath(dir_);
+    llvm::sys::path::append(hashPath, "libtigerrt.hash");
+
+    return writeFile(hashPath.str().str(), hash_ + "\n");
+}
+
+bool RuntimeLibrary::ensure() {
+    llvm::SmallString<128> hashPath(dir_);
+    llvm::sys::path::append(hashPath, "libtigerrt.hash");
+    auto built = readFile(hashPath.str().str());
+
+    std::string source = TIGER_RUNTIME_SOURCE;
+    hash_ = hashFile(source);
+    if (hash_.empty()) {
+        // installed without sources: trust the prebuilt artifacts
+        hash_ = built;
+        return llvm::sys::fs::exists(archive()) && llvm::sys::fs::exists(bitcode());
+    }
+
+    if (hash_ == built && llvm::sys::fs::exists(archive()) && llvm::sys::fs::exists(bitcode())) {
+        return true;
+    }
+
+    std::cout << "Building runtime library from \"" << source << "\"" << std::endl;
+
+    return build(source);
+}
@@ -0,0 +1,35 @@
+#ifndef RUNTIMELIB_HPP
+#define RUNTIMELIB_HPP
+
+#include <string>
+
+/*
+ * Prebuilt runtime library: "libtigerrt.a" and "libtigerrt.bc" built from
+ * src/utils/runtime.cpp, placed next to the tc executable.
+ *
+ * "libtigerrt.hash" stores the MD5 of the runtime.cpp they were built from.
+ * When runtime.cpp changes the artifacts are rebuilt on the next use.
+ */
+class RuntimeLibrary {
+    std::string dir_;
+    std::string hash_;
+
+    bool build(std::string const &source);
+
+public:
+    explicit RuntimeLibrary(std::string dir);
+
+    static std::string defaultDirectory(const char *argv0);
+
+    bool ensure();
+
+    std::string archive() const;
+
+    std::string bitcode() const;
+
+    const std::string &hash() const {
+        return hash_;
+    }
+};
+
+#endif  // RUNTIMELIB_HPP
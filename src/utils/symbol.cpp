@@ -0,0 +1,89 @@
+#include "symbol.hpp"
+#include <llvm/ADT/StringMap.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace {
+    /*
+     * The names live in fixed-size chunks that are never moved, so a name can
+     * be read without the lock once its id has been handed out. The chunks are
+     * found through blocks of chunk pointers, allocated as the pool grows.
+     */
+    class SymbolPool {
+        static constexpr unsigned chunkBits = 12;
+        static constexpr std::uint32_t chunkSize = 1u << chunkBits;
+        static constexpr unsigned blockBits = 10;
+        static constexpr std::uint32_t blockSize = 1u << blockBits;
+        static constexpr std::uint32_t maxBlocks = 1u << (32 - chunkBits - blockBits);
+
+        using Chunk = std::atomic<std::string *>;
+
+        std::mutex mutex_;
+        llvm::StringMap<std::uint32_t> ids_;
+        std::uint32_t size_{0};
+        std::atomic<Chunk *> blocks_[maxBlocks]{};
+
+    public:
+        SymbolPool() {
+            intern("");
+        }
+
+        ~SymbolPool() {
+            for (auto &block : blocks_) {
+                auto chunks = block.load(std::memory_order_relaxed);
+                if (!chunks) {
+                    break;
+                }
+                for (std::uint32_t chunk = 0; chunk < blockSize; ++chunk) {
+                    delete[] chunks[chunk].load(std::memory_order_relaxed);
+                }
+                delete[] chunks;
+            }
+        }
+
+        std::uint32_t intern(llvm::StringRef name) {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto inserted = ids_.try_emplace(name, size_);
+            if (!inserted.second) {
+                return inserted.first->second;
+            }
+
+            auto &block = blocks_[size_ >> (chunkBits + blockBits)];
+            auto chunks = block.load(std::memory_order_relaxed);
+            if (!chunks) {
+                chunks = new Chunk[blockSize]();
+                block.store(chunks, std::memory_order_release);
+            }
+
+            auto &slot = chunks[(size_ >> chunkBits) & (blockSize - 1)];
+            auto chunk = slot.load(std::memory_order_relaxed);
+            if (!chunk) {
+                chunk = new std::string[chunkSize];
+                slot.store(chunk, std::memory_order_release);
+            }
+            chunk[size_ & (chunkSize - 1)] = name.str();
+
+            return size_++;
+        }
+
+        std::string const &name(std::uint32_t id) const {
+            auto chunks = blocks_[id >> (chunkBits + blockBits)].load(std::memory_order_acquire);
+            auto chunk = chunks[(id >> chunkBits) & (blockSize - 1)].load(std::memory_order_acquire);
+
+            return chunk[id & (chunkSize - 1)];
+        }
+    };
+
+    SymbolPool &pool() {
+        static SymbolPool pool;
+        return pool;
+    }
+}  // namespace
+
+Symbol::Symbol(llvm::StringRef name) : id_(pool().intern(name)) {}
+
+std::string const &Symbol::getName() const {
+    return pool().name(id_);
+}
@@ -0,0 +1,60 @@
+#ifndef SYMBOL_HPP
+#define SYMBOL_HPP
+
+#include <llvm/ADT/StringRef.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/*
+ * Interned identifier: a 32-bit id into a process-wide string pool, so the
+ * symbol tables hash and compare integers instead of names.
+ *
+ * Interning takes a lock, reading the name of a symbol does not. A default
+ * symbol is the empty name.
+ */
+class Symbol {
+    std::uint32_t id_{0};
+
+public:
+    Symbol() = default;
+
+    explicit Symbol(llvm::StringRef name);
+
+    explicit Symbol(char const *name) : Symbol(llvm::StringRef(name)) {}
+
+    explicit Symbol(std::string const &name) : Symbol(llvm::StringRef(name)) {}
+
+    std::uint32_t getId() const {
+        return id_;
+    }
+
+    std::string const &getName() const;
+
+    bool empty() const {
+        return id_ == 0;
+    }
+
+    friend bool operator==(Symbol a, Symbol b) {
+        return a.id_ == b.id_;
+    }
+
+    friend bool operator!=(Symbol a, Symbol b) {
+        return a.id_ != b.id_;
+    }
+
+    friend bool operator<(Symbol a, Symbol b) {
+        return a.id_ < b.id_;
+    }
+};
+
+namespace std {
+    template<>
+    struct hash<Symbol> {
+        size_t operator()(Symbol symbol) const {
+            return symbol.getId();
+        }
+    };
+}  // namespace std
+
+#endif  // SYMBOL_HPP
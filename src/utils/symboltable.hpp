@@ -1,98 +1,151 @@
-#ifndef SYMBOLTABLE_HPP
-#define SYMBOLTABLE_HPP
-
-#include <deque>
-#include <memory>
-#include <string>
-#include <unordered_map>
-
-template<typename T>
-class SymbolTable {
-    std::deque<std::unordered_map<std::string, T *>> stack_;
-
-public:
-    SymbolTable();
-
-    ~SymbolTable();
-
-    T *&operator[](std::string const &name);
-
-    T *&lookup(std::string const &name);
-
-    T *&lookupOne(std::string const &name);
-
-    void push(std::string const &name, T *const val);
-
-    void pop(std::string const &name);
-
-    void popOne(std::string const &name);
-
-    void enter();
-
-    void exit();
-
-    void reset();
-};
-
-template<typename T>
-SymbolTable<T>::SymbolTable() {
-    enter();
-}
-
-template<typename T>
-SymbolTable<T>::~SymbolTable() {
-    exit();
-}
-
-template<typename T>
-T *&SymbolTable<T>::operator[](const std::string &name) {
-    return lookup(name);
-}
-
-template<typename T>
-T *&SymbolTable<T>::lookup(const std::string &name) {
-    for (auto stack = stack_.begin(); stack != stack_.end(); ++stack) {
-        if (stack->find(name) != stack->end()) {
-            return (*stack)[name];
-        }
-    }
-
-    return stack_.front()[name];
-}
-
-template<typename T>
-T *&SymbolTable<T>::lookupOne(const std::string &name) {
-    if (stack_.front().find(name) != stack_.front().end()) {
-        return stack_.front()[name];
-    }
-
-    return stack_.front()[name];
-}
-
-template<typename T>
-void SymbolTable<T>::push(const std::string &name, T *const val) {
-    stack_.front()[name] = val;
-}
-
-template<typename T>
-void SymbolTable<T>::popOne(const std::string &name) {
-    stack_.front().erase(name);
-}
-
-template<typename T>
-void SymbolTable<T>::enter() {
-    stack_.push_front(std::unordered_map<std::string, T *>());
-}
-
-template<typename T>
-void SymbolTable<T>::exit() {
-    stack_.pop_front();
-}
-
-template<typename T>
-void SymbolTable<T>::reset() {
-    stack_.clear();
-    enter();
-}
-
-#endif  // SYMBOLTABLE_HPP
+#ifndef SYMBOLTABLE_HPP
+#define SYMBOLTABLE_HPP
+
+#include <llvm/ADT/DenseMap.h>
+#include <cstdint>
+#include "symbol.hpp"
+#include <vector>
+
+/*
+ * Scoped table of bindings. A single hash table maps each symbol to its
+ * innermost binding and every binding links to the one it shadows, so
+ * lookup, push and popOne are O(1). The bindings vector doubles as the undo
+ * log: exit() unlinks the bindings pushed since the matching enter(), no
+ * scope allocates anything.
+ */
+template<typename T>
+class SymbolTable {
+    static constexpr std::uint32_t none = ~0u;
+
+    struct Binding {
+        T *value;
+        std::uint32_t prev;
+        Symbol name;
+        std::uint32_t depth;
+        bool dead;
+    };
+
+    llvm::DenseMap<std::uint32_t, std::uint32_t> top_;
+    std::vector<Binding> bindings_;
+    std::vector<std::uint32_t> scopes_;
+
+    std::uint32_t find(Symbol name) const;
+
+public:
+    SymbolTable();
+
+    T *operator[](Symbol name) const;
+
+    T *lookup(Symbol name) const;
+
+    T *lookupOne(Symbol name) const;
+
+    void push(Symbol name, T *const val);
+
+    void popOne(Symbol name);
+
+    void enter();
+
+    void exit();
+
+    void reset();
+};
+
+template<typename T>
+constexpr std::uint32_t SymbolTable<T>::none;
+
+template<typename T>
+SymbolTable<T>::SymbolTable() {
+    enter();
+}
+
+template<typename T>
+std::uint32_t SymbolTable<T>::find(Symbol name) const {
+    auto top = top_.find(name.getId());
+
+    return top == top_.end() ? none : top->second;
+}
+
+template<typename T>
+T *SymbolTable<T>::operator[](Symbol name) const {
+    return lookup(name);
+}
+
+template<typename T>
+T *SymbolTable<T>::lookup(Symbol name) const {
+    for (auto idx = find(name); idx != none; idx = bindings_[idx].prev) {
+        if (!bindings_[idx].dead) {
+            return bindings_[idx].value;
+        }
+    }
+
+    return nullptr;
+}
+
+template<typename T>
+T *SymbolTable<T>::lookupOne(Symbol name) const {
+    auto idx = find(name);
+    if (idx == none || bindings_[idx].depth != scopes_.size() || bindings_[idx].dead) {
+        return nullptr;
+    }
+
+    return bindings_[idx].value;
+}
+
+template<typename T>
+void SymbolTable<T>::push(Symbol name, T *const val) {
+    auto depth = static_cast<std::uint32_t>(scopes_.size());
+    auto inserted = top_.try_emplace(name.getId(), static_cast<std::uint32_t>(bindings_.size()));
+    auto prev = none;
+    if (!inserted.second) {
+        auto &top = inserted.first->second;
+        if (bindings_[top].depth == depth) {
+            bindings_[top].value = val;
+            bindings_[top].dead = false;
+            return;
+        }
+
+        prev = top;
+        top = static_cast<std::uint32_t>(bindings_.size());
+    }
+
+    bindings_.push_back({val, prev, name, depth, false});
+}
+
+template<typename T>
+void SymbolTable<T>::popOne(Symbol name) {
+    auto idx = find(name);
+    if (idx != none && bindings_[idx].depth == scopes_.size()) {
+        bindings_[idx].dead = true;
+    }
+}
+
+template<typename T>
+void SymbolTable<T>::enter() {
+    scopes_.push_back(bindings_.size());
+}
+
+template<typename T>
+void SymbolTable<T>::exit() {
+    for (auto idx = bindings_.size(); idx-- > scopes_.back();) {
+        auto &binding = bindings_[idx];
+        if (binding.prev == none) {
+            top_.erase(binding.name.getId());
+        } else {
+            top_[binding.name.getId()] = binding.prev;
+        }
+    }
+
+    bindings_.resize(scopes_.back());
+    scopes_.pop_back();
+}
+
+template<typename T>
+void SymbolTable<T>::reset() {
+    top_.clear();
+    bindings_.clear();
+    scopes_.clear();
+    enter();
+}
+
+#endif  // SYMBOLTABLE_HPP
@@ -0,0 +1,148 @@
+#!/bin/sh
+
+# Stress test of deeply nested programs: ${DEPTH}-long "+", "&" and "|"
+# chains, a right-nested "x + (x + (...))", ${DEPTH} parentheses, an "if"
+# nested ${DEPTH} times in the "then" branch, a ${DEPTH}-deep "else if"
+# ladder, ${DEPTH} negations, a ${DEPTH}-long sequence, ${DEPTH} nested calls
+# and ${DEPTH} nested "let" are analysed with both parsers, then the same
+# programs ${RUN_DEPTH} deep are compiled and run and what they print is
+# checked. Each program is also written with "-emit-ast" and compiled again
+# "-from-ast". The code generation of LLVM is superlinear in the size of a
+# basic block, hence the smaller depth for the compiled programs.
+DEPTH=${DEPTH:-1000000}
+RUN_DEPTH=${RUN_DEPTH:-10000}
+
+mkdir -p build
+
+generate() {
+    awk -v n=$1 'BEGIN {
+        printf "let var x := 1 in printd(x"
+        for (i = 1; i < n; i++) printf " + x"
+        print ") end"
+    }' > build/stress_chain.tig
+
+    awk -v n=$1 'BEGIN {
+        printf "let var x := 1 in printd((x"
+        for (i = 1; i < n; i++) printf " & x"
+        printf ") * %d) end\n", n
+    }' > build/stress_and.tig
+
+    awk -v n=$1 'BEGIN {
+        printf "let var x := 1 in printd(x"
+        for (i = 1; i < n; i++) printf " + (x"
+        for (i = 1; i < n; i++) printf ")"
+        print ") end"
+    }' > build/stress_right.tig
+
+    awk -v n=$1 'BEGIN {
+        printf "let var x := %d in printd(", n
+        for (i = 0; i < n; i++) printf "("
+        printf "x"
+        for (i = 0; i < n; i++) printf ")"
+        print ") end"
+    }' > build/stress_paren.tig
+
+    awk -v n=$1 'BEGIN {
+        printf "let var x := 1 in printd("
+        for (i = 0; i < n; i++) printf "if x then "
+        printf "%d", n
+        for (i = 0; i < n; i++) printf " else 0"
+        print ") end"
+    }' > build/stress_then.tig
+
+    awk -v n=$1 'BEGIN {
+        printf "let var x := 0 in printd((x"
+        for (i = 1; i < n - 1; i++) printf " | x"
+        printf " | 1) * %d) end\n", n
+    }' > build/stress_or.tig
+
+    awk -v n=$1 'BEGIN {
+        printf "let var x := %d in printd(", n
+        for (i = 0; i < n; i++) printf "- "
+        printf "x * %d) end\n", n % 2 ? -1 : 1
+    }' > build/stress_negation.tig
+
+    awk -v n=$1 'BEGIN {
+        printf "let var x := %d in printd(", n - 1
+        for (i = 0; i < n; i++) printf "if x = %d then %d else\n", i, i
+        print "0) end"
+    }' > build/stress_ladder.tig
+
+    awk -v n=$1 'BEGIN {
+        print "let var x := 0 in ("
+        for (i = 0; i < n; i++) print "x := x + 1;"
+        print "printd(x)) end"
+    }' > build/stress_sequence.tig
+
+    awk -v n=$1 'BEGIN {
+        printf "let function f(a: int): int = a + 1 in printd("
+        for (i = 0; i < n; i++) printf "f("
+        printf "0"
+        for (i = 0; i < n; i++) printf ")"
+        print ") end"
+    }' > build/stress_call.tig
+
+    awk -v n=$1 'BEGIN {
+        print "let var x := 0 in"
+        for (i = 0; i < n; i++) print "let var x := x + 1 in"
+        printf "printd(x)"
+        for (i = 0; i <= n; i++) printf " end"
+        print ""
+    }' > build/stress_let.tig
+}
+
+# Compiles build/stress_$1 in the mode $2 (a parser or "-from-ast") with the options that follow.
+compile() {
+    source=build/stress_$1.tig
+    mode=$2
+    if [ ${mode} = -from-ast ]; then
+        build/tc -p ${source} -emit-ast=build/stress_$1.tast -no-codegen > /dev/null || return 1
+        source=build/stress_$1.tast
+    fi
+    shift 2
+
+    build/tc -p ${source} ${mode} "$@"
+}
+
+report() {
+    end=$(date +%s%N)
+    echo "$1: $2 ($(( (end - start) / 1000000 )) ms)"
+}
+
+status=0
+
+generate ${DEPTH}
+for mode in -parser=bison -parser=pratt -from-ast; do
+    for test in chain and or right paren then ladder negation sequence call let; do
+        start=$(date +%s%N)
+        if compile ${test} ${mode} -no-codegen | grep -q "Semantic analysis successful!"; then
+            result=ok
+        else
+            result=FAILED
+            status=1
+        fi
+        report "${mode} ${test} (depth ${DEPTH}, analysis)" ${result}
+    done
+done
+
+generate ${RUN_DEPTH}
+for mode in -parser=bison -parser=pratt -from-ast; do
+    for test in chain and or right paren then ladder negation sequence call let; do
+        expected=${RUN_DEPTH}
+        if [ ${test} = ladder ]; then
+            expected=$((RUN_DEPTH - 1))
+        fi
+
+        start=$(date +%s%N)
+        if compile ${test} ${mode} -o build/stress_${test} -codegen-opt=0 > /dev/null \
+            && [ "$(build/stress_${test})" = "${expected}" ]; then
+            result=ok
+        else
+            result=FAILED
+            status=1
+        fi
+        report "${mode} ${test} (depth ${RUN_DEPTH}, run)" ${result}
+    done
+done
+
+exit ${status}
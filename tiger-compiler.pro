@@ -44,6 +44,33 @@ bison_header.CONFIG += target_predeps no_link
 silent:bison_header.commands = @echo Bison ${QMAKE_FILE_IN} && $$bison.commands
 QMAKE_EXTRA_COMPILERS += bison_header
 
+# Prebuilt runtime library, used by tc when no "-l" is given. tc rebuilds it when
+# the MD5 of runtime.cpp no longer matches "libtigerrt.hash".
+DEFINES += TIGER_RUNTIME_SOURCE=\\\"$$PWD/src/utils/runtime.cpp\\\"
+
+runtime_lib.target = build/libtigerrt.a
+runtime_lib.depends = $$PWD/src/utils/runtime.cpp
+runtime_lib.commands = mkdir -p build && \
+    clang++ -O2 -fPIC -c $$PWD/src/utils/runtime.cpp -o build/libtigerrt.o && \
+    ar rcs build/libtigerrt.a build/libtigerrt.o && \
+    md5sum $$PWD/src/utils/runtime.cpp | cut -c1-32 > build/libtigerrt.hash
+
+runtime_bc.target = build/libtigerrt.bc
+runtime_bc.depends = $$PWD/src/utils/runtime.cpp
+runtime_bc.commands = mkdir -p build && \
+    clang++ -O2 -fPIC -c -emit-llvm $$PWD/src/utils/runtime.cpp -o build/libtigerrt.bc
+
+runtime.depends = build/libtigerrt.a build/libtigerrt.bc
+
+QMAKE_EXTRA_TARGETS += runtime_lib runtime_bc runtime
+PRE_TARGETDEPS += build/libtigerrt.a build/libtigerrt.bc
+
+# Link the executables in-process with lld: "qmake CONFIG+=lld tiger-compiler.pro"
+lld {
+    DEFINES += TIGER_LLD
+    LIBS += -L$$system($$LLVM --libdir) -llldELF -llldCommon
+}
+
 # The following define makes your compiler warn you if you use any
 # feature of Qt which has been marked as deprecated (the exact warnings
 # depend on your compiler). Please consult the documentation of the
@@ -56,14 +83,34 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 # Input
-HEADERS += src/ast/ast.hpp \
+HEADERS += src/ast/arena.hpp \
+           src/ast/ast.hpp \
+           src/ast/astfile.hpp \
+           src/parser/prattparser.hpp \
+           src/utils/buildcache.hpp \
            src/utils/codegencontext.hpp \
+           src/utils/jit.hpp \
+           src/utils/linetable.hpp \
+           src/utils/linker.hpp \
+           src/utils/phasetimer.hpp \
+           src/utils/runtime.hpp \
+           src/utils/runtimelib.hpp \
+           src/utils/symbol.hpp \
            src/utils/symboltable.hpp
 
 SOURCES += src/main.cpp \
            src/ast/ast.cpp \
+           src/ast/astfile.cpp \
            src/codegen/codegen.cpp \
+           src/parser/prattparser.cpp \
+           src/utils/buildcache.cpp \
            src/utils/codegencontext.cpp \
+           src/utils/jit.cpp \
+           src/utils/linetable.cpp \
+           src/utils/linker.cpp \
+           src/utils/phasetimer.cpp \
+           src/utils/runtimelib.cpp \
+           src/utils/symbol.cpp \
            src/utils/symboltable.cpp \
            src/utils/runtime.cpp \
 